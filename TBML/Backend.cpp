@@ -0,0 +1,1153 @@
+﻿#include <omp.h>
+#include <atomic>
+#include <cstdlib>
+#include "stdafx.h"
+#include "Backend.h"
+
+#ifdef TBML_USE_CBLAS
+#include <cblas.h>
+#endif
+
+namespace tbml
+{
+	namespace backend
+	{
+		namespace
+		{
+			// Below this many elements threading costs more than it saves
+			const size_t PARALLEL_THRESHOLD = 1 << 16;
+
+			// Rows of c computed per packed micro-kernel tile
+			const size_t ROW_BLOCK = 8;
+
+			// Rows of c accumulated at once by the sparse kernel, each nonzero is applied across the whole block
+			const size_t SPARSE_ROW_BLOCK = 64;
+
+			// Elements per loss reduction block, each reduced by one thread
+			const size_t LOSS_BLOCK = 4096;
+
+			// Rows whose running maxima are kept while walking the columns in argmaxRows
+			const size_t ARGMAX_ROW_BLOCK = 256;
+
+			// Output positions [first, last) along one axis whose kernel tap at offset lands inside size, the rest read padding
+			inline void getConvRange(size_t size, size_t outSize, size_t offset, size_t stride, size_t padding, size_t& first, size_t& last)
+			{
+				first = offset >= padding ? 0 : (padding - offset + stride - 1) / stride;
+				last = size + padding > offset ? std::min(outSize, (size + padding - offset + stride - 1) / stride) : 0;
+				if (first > last) first = last;
+			}
+
+			// Accumulate the (rowCount x PANEL_WIDTH) tile of a (m x k) * panel starting at row0
+			inline void accumulateTile(size_t m, size_t k, size_t row0, size_t rowCount, const float* a, const float* panel, float (&acc)[PANEL_WIDTH][ROW_BLOCK])
+			{
+				// Full tiles have a constant trip count so the inner loop unrolls
+				if (rowCount == ROW_BLOCK)
+				{
+					for (size_t i = 0; i < k; i++)
+					{
+						const float* aCol = a + row0 + i * m;
+						const float* bRow = panel + i * PANEL_WIDTH;
+						for (size_t c = 0; c < PANEL_WIDTH; c++)
+						{
+							for (size_t r = 0; r < ROW_BLOCK; r++) acc[c][r] += aCol[r] * bRow[c];
+						}
+					}
+				}
+				else
+				{
+					for (size_t i = 0; i < k; i++)
+					{
+						const float* aCol = a + row0 + i * m;
+						const float* bRow = panel + i * PANEL_WIDTH;
+						for (size_t c = 0; c < PANEL_WIDTH; c++)
+						{
+							for (size_t r = 0; r < rowCount; r++) acc[c][r] += aCol[r] * bRow[c];
+						}
+					}
+				}
+			}
+
+			// out[i] = fn(acc[i] + bias), switching once per column rather than per element
+			inline void storeActivated(Activation fn, size_t count, const float* acc, float bias, float* out)
+			{
+				switch (fn)
+				{
+				case Activation::Identity:
+					for (size_t i = 0; i < count; i++) out[i] = acc[i] + bias;
+					break;
+				case Activation::ReLU:
+					for (size_t i = 0; i < count; i++)
+					{
+						float v = acc[i] + bias;
+						out[i] = v > 0.0f ? v : 0.0f;
+					}
+					break;
+				case Activation::Sigmoid:
+					for (size_t i = 0; i < count; i++) out[i] = 1.0f / (1.0f + std::exp(-(acc[i] + bias)));
+					break;
+				case Activation::TanH:
+					for (size_t i = 0; i < count; i++) out[i] = tanhf(acc[i] + bias);
+					break;
+				}
+			}
+
+			std::string readEnvironment(const char* name)
+			{
+#ifdef _MSC_VER
+				char* value = nullptr;
+				size_t length = 0;
+				if (_dupenv_s(&value, &length, name) != 0 || value == nullptr) return "";
+				std::string result(value);
+				free(value);
+				return result;
+#else
+				const char* value = std::getenv(name);
+				return value != nullptr ? value : "";
+#endif
+			}
+
+			// Backends are never removed once registered so raw pointers stay valid
+			std::mutex registryMutex;
+			std::vector<BasePtr> registry;
+			std::atomic<const Base*> current{ nullptr };
+			std::once_flag initFlag;
+
+			const Base* findBackend(const std::string& name)
+			{
+				for (auto it = registry.rbegin(); it != registry.rend(); ++it)
+				{
+					if ((*it)->getName() == name) return it->get();
+				}
+				return nullptr;
+			}
+
+			void initialize()
+			{
+				std::lock_guard<std::mutex> lock(registryMutex);
+				registry.push_back(std::make_shared<Reference>());
+				registry.push_back(std::make_shared<Optimized>());
+#ifdef TBML_USE_CBLAS
+				registry.push_back(std::make_shared<Blas>());
+#endif
+
+				// Select with TBML_BACKEND if set
+				const Base* selected = findBackend("optimized");
+				std::string name = readEnvironment("TBML_BACKEND");
+				if (!name.empty())
+				{
+					const Base* named = findBackend(name);
+					if (named != nullptr) selected = named;
+					else std::cerr << "tbml::backend: Unknown TBML_BACKEND `" << name << "`, using " << selected->getName() << "." << std::endl;
+				}
+				current.store(selected, std::memory_order_release);
+			}
+		}
+
+		void packPanels(size_t rows, size_t cols, const float* b, float* packed, bool transposed)
+		{
+			// panel[p][i * PANEL_WIDTH + c] = b(i, p * PANEL_WIDTH + c), padding is left untouched
+			for (size_t col = 0; col < cols; col++)
+			{
+				float* panel = packed + (col / PANEL_WIDTH) * PANEL_WIDTH * rows;
+				if (transposed)
+				{
+					for (size_t row = 0; row < rows; row++) panel[row * PANEL_WIDTH + (col % PANEL_WIDTH)] = b[col + cols * row];
+				}
+				else
+				{
+					const float* bCol = b + rows * col;
+					for (size_t row = 0; row < rows; row++) panel[row * PANEL_WIDTH + (col % PANEL_WIDTH)] = bCol[row];
+				}
+			}
+		}
+
+		const Base& get()
+		{
+			const Base* backend = current.load(std::memory_order_acquire);
+			if (backend == nullptr)
+			{
+				std::call_once(initFlag, initialize);
+				backend = current.load(std::memory_order_acquire);
+			}
+			return *backend;
+		}
+
+		bool setBackend(const std::string& name)
+		{
+			std::call_once(initFlag, initialize);
+			std::lock_guard<std::mutex> lock(registryMutex);
+			const Base* backend = findBackend(name);
+			if (backend == nullptr) return false;
+			current.store(backend, std::memory_order_release);
+			return true;
+		}
+
+		void registerBackend(BasePtr backend)
+		{
+			std::call_once(initFlag, initialize);
+			std::lock_guard<std::mutex> lock(registryMutex);
+			registry.push_back(std::move(backend));
+		}
+
+		std::vector<std::string> getBackendNames()
+		{
+			std::call_once(initFlag, initialize);
+			std::lock_guard<std::mutex> lock(registryMutex);
+			std::vector<std::string> names;
+			for (const auto& backend : registry) names.push_back(backend->getName());
+			return names;
+		}
+
+		void Base::gemmBiasActivateUnpacked(size_t m, size_t n, size_t k, const float* a, const float* b, const float* bias, Activation fn, float* c) const
+		{
+			gemm(false, false, m, n, k, 1.0f, a, b, 0.0f, c);
+			if (bias != nullptr) addRows(m, n, c, bias);
+			activate(fn, m * n, c, c);
+		}
+
+		void Reference::gemm(bool transA, bool transB, size_t m, size_t n, size_t k, float alpha, const float* a, const float* b, float beta, float* c) const
+		{
+			#pragma omp parallel for
+			for (int row = 0; row < (int)m; row++)
+			{
+				for (int ocol = 0; ocol < (int)n; ocol++)
+				{
+					float acc = 0.0f;
+					for (int i = 0; i < (int)k; i++)
+					{
+						float av = transA ? a[i + k * row] : a[row + m * i];
+						float bv = transB ? b[ocol + n * i] : b[i + k * ocol];
+						acc += av * bv;
+					}
+
+					float& out = c[row + m * ocol];
+					out = beta == 0.0f ? alpha * acc : alpha * acc + beta * out;
+				}
+			}
+		}
+
+		void Reference::gemmPacked(size_t m, size_t n, size_t k, float alpha, const float* a, const float* bPacked, float beta, float* c) const
+		{
+			for (size_t row = 0; row < m; row++)
+			{
+				for (size_t col = 0; col < n; col++)
+				{
+					const float* panel = bPacked + (col / PANEL_WIDTH) * PANEL_WIDTH * k;
+					float acc = 0.0f;
+					for (size_t i = 0; i < k; i++) acc += a[row + m * i] * panel[i * PANEL_WIDTH + (col % PANEL_WIDTH)];
+
+					float& out = c[row + m * col];
+					out = beta == 0.0f ? alpha * acc : alpha * acc + beta * out;
+				}
+			}
+		}
+
+		void Reference::gemmBiasActivate(size_t m, size_t n, size_t k, const float* a, const float* bPacked, const float* bias, Activation fn, float* c) const
+		{
+			// Unfused, each step is a separate pass over c
+			gemmPacked(m, n, k, 1.0f, a, bPacked, 0.0f, c);
+			if (bias != nullptr) addRows(m, n, c, bias);
+			activate(fn, m * n, c, c);
+		}
+
+		void Reference::gemv(size_t n, size_t k, const float* x, const float* w, const float* bias, Activation fn, float* y) const
+		{
+			for (size_t col = 0; col < n; col++)
+			{
+				float acc = 0.0f;
+				for (size_t i = 0; i < k; i++) acc += x[i] * w[i + k * col];
+				y[col] = acc + (bias != nullptr ? bias[col] : 0.0f);
+			}
+			activate(fn, n, y, y);
+		}
+
+		void Reference::sparseGemmBiasActivate(size_t m, size_t n, const float* a, const uint32_t* colStarts, const uint32_t* rowIndices, const float* values, const float* bias, Activation fn, float* c) const
+		{
+			for (size_t col = 0; col < n; col++)
+			{
+				for (size_t row = 0; row < m; row++)
+				{
+					float acc = 0.0f;
+					for (uint32_t i = colStarts[col]; i < colStarts[col + 1]; i++) acc += a[row + m * rowIndices[i]] * values[i];
+					c[row + m * col] = acc + (bias != nullptr ? bias[col] : 0.0f);
+				}
+			}
+			activate(fn, m * n, c, c);
+		}
+
+		void Reference::add(size_t n, float* a, const float* b) const { for (size_t i = 0; i < n; i++) a[i] += b[i]; }
+
+		void Reference::sub(size_t n, float* a, const float* b) const { for (size_t i = 0; i < n; i++) a[i] -= b[i]; }
+
+		void Reference::mult(size_t n, float* a, const float* b) const { for (size_t i = 0; i < n; i++) a[i] *= b[i]; }
+
+		void Reference::div(size_t n, float* a, const float* b) const { for (size_t i = 0; i < n; i++) a[i] /= b[i]; }
+
+		void Reference::add(size_t n, float* a, float v) const { for (size_t i = 0; i < n; i++) a[i] += v; }
+
+		void Reference::mult(size_t n, float* a, float v) const { for (size_t i = 0; i < n; i++) a[i] *= v; }
+
+		void Reference::div(size_t n, float* a, float v) const { for (size_t i = 0; i < n; i++) a[i] /= v; }
+
+		void Reference::axpby(size_t n, float alpha, const float* x, float beta, float* y) const
+		{
+			if (beta == 0.0f) for (size_t i = 0; i < n; i++) y[i] = alpha * x[i];
+			else for (size_t i = 0; i < n; i++) y[i] = alpha * x[i] + beta * y[i];
+		}
+
+		void Reference::multAcc(size_t n, float alpha, const float* a, const float* b, float beta, float* y) const
+		{
+			if (beta == 0.0f) for (size_t i = 0; i < n; i++) y[i] = alpha * a[i] * b[i];
+			else for (size_t i = 0; i < n; i++) y[i] = alpha * a[i] * b[i] + beta * y[i];
+		}
+
+		void Reference::sgdMomentum(size_t n, float learningRate, float momentumRate, const float* grad, float* momentum, float* param) const
+		{
+			for (size_t i = 0; i < n; i++)
+			{
+				momentum[i] = momentumRate * momentum[i] - learningRate * grad[i];
+				param[i] += momentum[i];
+			}
+		}
+
+		void Reference::adam(size_t n, float learningRate, float beta1, float beta2, float epsilon, float weightDecay, size_t t, const float* grad, float* m, float* v, float* param) const
+		{
+			float correction1 = 1.0f - std::pow(beta1, (float)t);
+			float correction2 = 1.0f - std::pow(beta2, (float)t);
+			for (size_t i = 0; i < n; i++)
+			{
+				m[i] = beta1 * m[i] + (1.0f - beta1) * grad[i];
+				v[i] = beta2 * v[i] + (1.0f - beta2) * grad[i] * grad[i];
+				float mHat = m[i] / correction1;
+				float vHat = v[i] / correction2;
+				param[i] -= learningRate * (mHat / (std::sqrt(vHat) + epsilon) + weightDecay * param[i]);
+			}
+		}
+
+		void Reference::sumRows(size_t m, size_t n, float alpha, const float* a, float beta, float* out) const
+		{
+			for (size_t col = 0; col < n; col++)
+			{
+				float acc = 0.0f;
+				for (size_t row = 0; row < m; row++) acc += a[row + m * col];
+				out[col] = beta == 0.0f ? alpha * acc : alpha * acc + beta * out[col];
+			}
+		}
+
+		void Reference::addRows(size_t m, size_t n, float* a, const float* row) const
+		{
+			for (size_t i = 0; i < m * n; i++) a[i] += row[i / m];
+		}
+
+		float Reference::sum(size_t n, const float* a) const
+		{
+			float acc = 0.0f;
+			for (size_t i = 0; i < n; i++) acc += a[i];
+			return acc;
+		}
+
+		float Reference::max(size_t n, const float* a) const
+		{
+			assert(n > 0);
+			float acc = a[0];
+			for (size_t i = 1; i < n; i++) acc = std::max(acc, a[i]);
+			return acc;
+		}
+
+		void Reference::activate(Activation fn, size_t n, const float* in, float* out) const
+		{
+			switch (fn)
+			{
+			case Activation::Identity:
+				for (size_t i = 0; i < n; i++) out[i] = in[i];
+				break;
+			case Activation::ReLU:
+				for (size_t i = 0; i < n; i++) out[i] = std::max(0.0f, in[i]);
+				break;
+			case Activation::Sigmoid:
+				for (size_t i = 0; i < n; i++) out[i] = 1.0f / (1.0f + std::exp(-in[i]));
+				break;
+			case Activation::TanH:
+				for (size_t i = 0; i < n; i++) out[i] = tanhf(in[i]);
+				break;
+			}
+		}
+
+		void Reference::activateGrad(Activation fn, size_t n, const float* out, const float* gradOut, float* gradIn) const
+		{
+			switch (fn)
+			{
+			case Activation::Identity:
+				for (size_t i = 0; i < n; i++) gradIn[i] = gradOut[i];
+				break;
+			case Activation::ReLU:
+				for (size_t i = 0; i < n; i++) gradIn[i] = (out[i] > 0 ? 1.0f : 0.0f) * gradOut[i];
+				break;
+			case Activation::Sigmoid:
+				for (size_t i = 0; i < n; i++) gradIn[i] = out[i] * (1.0f - out[i]) * gradOut[i];
+				break;
+			case Activation::TanH:
+				for (size_t i = 0; i < n; i++) gradIn[i] = (1.0f - (out[i] * out[i])) * gradOut[i];
+				break;
+			}
+		}
+
+		void Reference::softmax(size_t m, size_t n, const float* in, float* out) const
+		{
+			// Independent per row
+			for (size_t row = 0; row < m; row++)
+			{
+				// Calculate max of row for stability
+				float max = in[row];
+				for (size_t i = 1; i < n; i++) max = std::max(max, in[row + m * i]);
+
+				// SoftMax of each element in row = e^(X(i) - max) / Σ e^(X(i) - max)
+				float sum = 0.0;
+				for (size_t i = 0; i < n; i++)
+				{
+					out[row + m * i] = std::exp(in[row + m * i] - max);
+					sum += out[row + m * i];
+				}
+				for (size_t i = 0; i < n; i++) out[row + m * i] /= sum;
+			}
+		}
+
+		void Reference::softmaxGrad(size_t m, size_t n, const float* out, const float* gradOut, float* gradIn) const
+		{
+			for (size_t row = 0; row < m; row++)
+			{
+				float dot = 0.0f;
+				for (size_t i = 0; i < n; i++) dot += out[row + m * i] * gradOut[row + m * i];
+				for (size_t i = 0; i < n; i++) gradIn[row + m * i] = out[row + m * i] * (gradOut[row + m * i] - dot);
+			}
+		}
+
+		float Reference::softmaxCrossEntropy(size_t m, size_t n, const float* logits, const float* expected, float* grad) const
+		{
+			float loss = 0.0f;
+			for (size_t row = 0; row < m; row++)
+			{
+				// log softmax(X(i)) = X(i) - log Σ e^X = X(i) - max - log Σ e^(X - max)
+				float max = logits[row];
+				for (size_t i = 1; i < n; i++) max = std::max(max, logits[row + m * i]);
+				float sum = 0.0f;
+				for (size_t i = 0; i < n; i++) sum += std::exp(logits[row + m * i] - max);
+				float logSumExp = max + std::log(sum);
+
+				for (size_t i = 0; i < n; i++)
+				{
+					float logProb = logits[row + m * i] - logSumExp;
+					loss += -expected[row + m * i] * logProb;
+					grad[row + m * i] = std::exp(logProb) - expected[row + m * i];
+				}
+			}
+			return loss / m;
+		}
+
+		float Reference::squareError(size_t n, const float* output, const float* expected, float* grad) const
+		{
+			float loss = 0.0f;
+			for (size_t i = 0; i < n; i++)
+			{
+				grad[i] = output[i] - expected[i];
+				loss += grad[i] * grad[i];
+			}
+			return loss;
+		}
+
+		float Reference::crossEntropy(size_t n, const float* output, const float* expected, float* grad) const
+		{
+			float loss = 0.0f;
+			for (size_t i = 0; i < n; i++)
+			{
+				loss += -expected[i] * std::log(output[i] + 1e-15f);
+				grad[i] = -expected[i] / (output[i] + 1e-15f);
+			}
+			return loss;
+		}
+
+		void Reference::argmaxRows(size_t m, size_t n, const float* a, uint32_t* out) const
+		{
+			for (size_t row = 0; row < m; row++)
+			{
+				out[row] = 0;
+				for (size_t i = 1; i < n; i++)
+				{
+					if (a[row + m * i] > a[row + m * out[row]]) out[row] = (uint32_t)i;
+				}
+			}
+		}
+
+		void Reference::im2col(const ConvShape& conv, size_t batch, const float* input, float* columns) const
+		{
+			size_t outHeight = conv.getOutHeight();
+			size_t outWidth = conv.getOutWidth();
+			size_t rows = batch * outHeight * outWidth;
+			for (size_t col = 0; col < conv.getPatchSize(); col++)
+			{
+				size_t c = col / (conv.kernel * conv.kernel);
+				size_t ky = (col / conv.kernel) % conv.kernel;
+				size_t kx = col % conv.kernel;
+				for (size_t y = 0; y < outHeight; y++)
+				{
+					for (size_t x = 0; x < outWidth; x++)
+					{
+						ptrdiff_t iy = (ptrdiff_t)(y * conv.stride + ky) - (ptrdiff_t)conv.padding;
+						ptrdiff_t ix = (ptrdiff_t)(x * conv.stride + kx) - (ptrdiff_t)conv.padding;
+						bool isInside = iy >= 0 && iy < (ptrdiff_t)conv.height && ix >= 0 && ix < (ptrdiff_t)conv.width;
+						for (size_t n = 0; n < batch; n++)
+						{
+							size_t pixel = c * conv.height * conv.width + iy * conv.width + ix;
+							columns[n + batch * (y * outWidth + x) + rows * col] = isInside ? input[n + batch * pixel] : 0.0f;
+						}
+					}
+				}
+			}
+		}
+
+		void Reference::col2im(const ConvShape& conv, size_t batch, const float* columns, float* gradInput) const
+		{
+			size_t outHeight = conv.getOutHeight();
+			size_t outWidth = conv.getOutWidth();
+			size_t rows = batch * outHeight * outWidth;
+			std::fill(gradInput, gradInput + batch * conv.getInputSize(), 0.0f);
+			for (size_t col = 0; col < conv.getPatchSize(); col++)
+			{
+				size_t c = col / (conv.kernel * conv.kernel);
+				size_t ky = (col / conv.kernel) % conv.kernel;
+				size_t kx = col % conv.kernel;
+				for (size_t y = 0; y < outHeight; y++)
+				{
+					for (size_t x = 0; x < outWidth; x++)
+					{
+						ptrdiff_t iy = (ptrdiff_t)(y * conv.stride + ky) - (ptrdiff_t)conv.padding;
+						ptrdiff_t ix = (ptrdiff_t)(x * conv.stride + kx) - (ptrdiff_t)conv.padding;
+						if (iy < 0 || iy >= (ptrdiff_t)conv.height || ix < 0 || ix >= (ptrdiff_t)conv.width) continue;
+						for (size_t n = 0; n < batch; n++)
+						{
+							size_t pixel = c * conv.height * conv.width + iy * conv.width + ix;
+							gradInput[n + batch * pixel] += columns[n + batch * (y * outWidth + x) + rows * col];
+						}
+					}
+				}
+			}
+		}
+
+		void Optimized::gemm(bool transA, bool transB, size_t m, size_t n, size_t k, float alpha, const float* a, const float* b, float beta, float* c) const
+		{
+			// Pack op(b) then run the packed kernel, callers reusing b should pack once instead
+			// Scratch is kept per thread so repeated calls do not allocate
+			thread_local std::vector<float> packed;
+			thread_local std::vector<float> aT;
+			size_t panels = (n + PANEL_WIDTH - 1) / PANEL_WIDTH;
+			packed.assign(panels * PANEL_WIDTH * k, 0.0f);
+			packPanels(k, n, b, packed.data(), transB);
+
+			// The kernel reads columns of a so a transposed a is copied out first
+			if (transA)
+			{
+				aT.resize(m * k);
+				#pragma omp parallel for if (m * k > PARALLEL_THRESHOLD)
+				for (int i = 0; i < (int)k; i++)
+				{
+					for (size_t row = 0; row < m; row++) aT[row + m * i] = a[i + k * row];
+				}
+				gemmPacked(m, n, k, alpha, aT.data(), packed.data(), beta, c);
+			}
+			else gemmPacked(m, n, k, alpha, a, packed.data(), beta, c);
+		}
+
+		void Optimized::gemmPacked(size_t m, size_t n, size_t k, float alpha, const float* a, const float* bPacked, float beta, float* c) const
+		{
+			// Micro-kernel accumulates a (ROW_BLOCK x PANEL_WIDTH) tile of c in registers
+			// Reading a column slice of a and one packed row of the panel per step
+			const int rowBlocks = (int)((m + ROW_BLOCK - 1) / ROW_BLOCK);
+			const int panels = (int)((n + PANEL_WIDTH - 1) / PANEL_WIDTH);
+			const int tiles = rowBlocks * panels;
+
+			#pragma omp parallel for if (m * n * k > 32'768)
+			for (int tile = 0; tile < tiles; tile++)
+			{
+				size_t row0 = (size_t)(tile % rowBlocks) * ROW_BLOCK;
+				size_t col0 = (size_t)(tile / rowBlocks) * PANEL_WIDTH;
+				size_t rowCount = std::min(ROW_BLOCK, m - row0);
+				size_t colCount = std::min(PANEL_WIDTH, n - col0);
+
+				float acc[PANEL_WIDTH][ROW_BLOCK] = {};
+				accumulateTile(m, k, row0, rowCount, a, bPacked + col0 * k, acc);
+
+				// Scale and accumulate into c while the tile is still in registers
+				for (size_t col = 0; col < colCount; col++)
+				{
+					float* cCol = c + row0 + m * (col0 + col);
+					if (beta == 0.0f) for (size_t r = 0; r < rowCount; r++) cCol[r] = alpha * acc[col][r];
+					else for (size_t r = 0; r < rowCount; r++) cCol[r] = alpha * acc[col][r] + beta * cCol[r];
+				}
+			}
+		}
+
+		void Optimized::gemmBiasActivate(size_t m, size_t n, size_t k, const float* a, const float* bPacked, const float* bias, Activation fn, float* c) const
+		{
+			// Same tiling as gemmPacked with bias and activation applied in the epilogue
+			// So c is written once instead of three passes for matmul, bias and activation
+			const int rowBlocks = (int)((m + ROW_BLOCK - 1) / ROW_BLOCK);
+			const int panels = (int)((n + PANEL_WIDTH - 1) / PANEL_WIDTH);
+			const int tiles = rowBlocks * panels;
+
+			#pragma omp parallel for if (m * n * k > 32'768)
+			for (int tile = 0; tile < tiles; tile++)
+			{
+				size_t row0 = (size_t)(tile % rowBlocks) * ROW_BLOCK;
+				size_t col0 = (size_t)(tile / rowBlocks) * PANEL_WIDTH;
+				size_t rowCount = std::min(ROW_BLOCK, m - row0);
+				size_t colCount = std::min(PANEL_WIDTH, n - col0);
+
+				float acc[PANEL_WIDTH][ROW_BLOCK] = {};
+				accumulateTile(m, k, row0, rowCount, a, bPacked + col0 * k, acc);
+
+				for (size_t col = 0; col < colCount; col++)
+				{
+					float biasValue = bias != nullptr ? bias[col0 + col] : 0.0f;
+					storeActivated(fn, rowCount, acc[col], biasValue, c + row0 + m * (col0 + col));
+				}
+			}
+		}
+
+		void Optimized::gemv(size_t n, size_t k, const float* x, const float* w, const float* bias, Activation fn, float* y) const
+		{
+			// Each column of w is contiguous so is streamed once against x
+			// Independent partial sums let the dot product vectorize
+			for (size_t col = 0; col < n; col++)
+			{
+				const float* wCol = w + col * k;
+				float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				size_t i = 0;
+				for (; i + 4 <= k; i += 4)
+				{
+					acc[0] += x[i + 0] * wCol[i + 0];
+					acc[1] += x[i + 1] * wCol[i + 1];
+					acc[2] += x[i + 2] * wCol[i + 2];
+					acc[3] += x[i + 3] * wCol[i + 3];
+				}
+				for (; i < k; i++) acc[0] += x[i] * wCol[i];
+				float dot = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+				storeActivated(fn, 1, &dot, bias != nullptr ? bias[col] : 0.0f, y + col);
+			}
+		}
+
+		void Optimized::sparseGemmBiasActivate(size_t m, size_t n, const float* a, const uint32_t* colStarts, const uint32_t* rowIndices, const float* values, const float* bias, Activation fn, float* c) const
+		{
+			// Each nonzero scales a contiguous column of a into a block of c, so the inner loop vectorizes like axpy
+			// Nonzeros are applied four at a time to read and write the block of c a quarter as often
+			const int rowBlocks = (int)((m + SPARSE_ROW_BLOCK - 1) / SPARSE_ROW_BLOCK);
+			const int tiles = rowBlocks * (int)n;
+
+			#pragma omp parallel for if (m * colStarts[n] > PARALLEL_THRESHOLD)
+			for (int tile = 0; tile < tiles; tile++)
+			{
+				size_t row0 = (size_t)(tile % rowBlocks) * SPARSE_ROW_BLOCK;
+				size_t col = (size_t)(tile / rowBlocks);
+				size_t rowCount = std::min(SPARSE_ROW_BLOCK, m - row0);
+				const float* aBlock = a + row0;
+
+				float acc[SPARSE_ROW_BLOCK] = {};
+				uint32_t i = colStarts[col];
+				uint32_t end = colStarts[col + 1];
+				for (; i + 4 <= end; i += 4)
+				{
+					const float* a0 = aBlock + m * rowIndices[i + 0];
+					const float* a1 = aBlock + m * rowIndices[i + 1];
+					const float* a2 = aBlock + m * rowIndices[i + 2];
+					const float* a3 = aBlock + m * rowIndices[i + 3];
+					float v0 = values[i + 0], v1 = values[i + 1], v2 = values[i + 2], v3 = values[i + 3];
+					for (size_t r = 0; r < rowCount; r++) acc[r] += (a0[r] * v0 + a1[r] * v1) + (a2[r] * v2 + a3[r] * v3);
+				}
+				for (; i < end; i++)
+				{
+					const float* a0 = aBlock + m * rowIndices[i];
+					float v0 = values[i];
+					for (size_t r = 0; r < rowCount; r++) acc[r] += a0[r] * v0;
+				}
+
+				storeActivated(fn, rowCount, acc, bias != nullptr ? bias[col] : 0.0f, c + row0 + m * col);
+			}
+		}
+
+		void Optimized::add(size_t n, float* a, const float* b) const
+		{
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++) a[i] += b[i];
+		}
+
+		void Optimized::sub(size_t n, float* a, const float* b) const
+		{
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++) a[i] -= b[i];
+		}
+
+		void Optimized::mult(size_t n, float* a, const float* b) const
+		{
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++) a[i] *= b[i];
+		}
+
+		void Optimized::div(size_t n, float* a, const float* b) const
+		{
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++) a[i] /= b[i];
+		}
+
+		void Optimized::add(size_t n, float* a, float v) const
+		{
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++) a[i] += v;
+		}
+
+		void Optimized::mult(size_t n, float* a, float v) const
+		{
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++) a[i] *= v;
+		}
+
+		void Optimized::div(size_t n, float* a, float v) const
+		{
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++) a[i] /= v;
+		}
+
+		void Optimized::axpby(size_t n, float alpha, const float* x, float beta, float* y) const
+		{
+			// Stale Inf or NaN in y would survive beta * y, so beta 0 overwrites instead
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++) y[i] = alpha * x[i] + (beta == 0.0f ? 0.0f : beta * y[i]);
+		}
+
+		void Optimized::multAcc(size_t n, float alpha, const float* a, const float* b, float beta, float* y) const
+		{
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++) y[i] = alpha * a[i] * b[i] + (beta == 0.0f ? 0.0f : beta * y[i]);
+		}
+
+		void Optimized::sgdMomentum(size_t n, float learningRate, float momentumRate, const float* grad, float* momentum, float* param) const
+		{
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++)
+			{
+				float update = momentumRate * momentum[i] - learningRate * grad[i];
+				momentum[i] = update;
+				param[i] += update;
+			}
+		}
+
+		void Optimized::adam(size_t n, float learningRate, float beta1, float beta2, float epsilon, float weightDecay, size_t t, const float* grad, float* m, float* v, float* param) const
+		{
+			// Bias corrections folded into per-step constants so each element is one pass with one sqrt and divide
+			float stepSize = learningRate / (1.0f - std::pow(beta1, (float)t));
+			float vScale = 1.0f / std::sqrt(1.0f - std::pow(beta2, (float)t));
+			float decay = 1.0f - learningRate * weightDecay;
+			#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++)
+			{
+				float g = grad[i];
+				float mi = beta1 * m[i] + (1.0f - beta1) * g;
+				float vi = beta2 * v[i] + (1.0f - beta2) * g * g;
+				m[i] = mi;
+				v[i] = vi;
+				param[i] = decay * param[i] - stepSize * mi / (std::sqrt(vi) * vScale + epsilon);
+			}
+		}
+
+		void Optimized::sumRows(size_t m, size_t n, float alpha, const float* a, float beta, float* out) const
+		{
+			// One thread per column with a serial sum keeps the result deterministic
+			#pragma omp parallel for if (m * n > PARALLEL_THRESHOLD)
+			for (int col = 0; col < (int)n; col++)
+			{
+				const float* aCol = a + m * col;
+				float acc = 0.0f;
+				for (size_t row = 0; row < m; row++) acc += aCol[row];
+				out[col] = beta == 0.0f ? alpha * acc : alpha * acc + beta * out[col];
+			}
+		}
+
+		void Optimized::addRows(size_t m, size_t n, float* a, const float* row) const
+		{
+			// Column-major so each column gets a single broadcast value
+			#pragma omp parallel for if (m * n > PARALLEL_THRESHOLD)
+			for (int col = 0; col < (int)n; col++)
+			{
+				float* aCol = a + m * col;
+				float v = row[col];
+				for (size_t r = 0; r < m; r++) aCol[r] += v;
+			}
+		}
+
+		float Optimized::sum(size_t n, const float* a) const
+		{
+			float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			size_t i = 0;
+			for (; i + 4 <= n; i += 4)
+			{
+				acc[0] += a[i + 0];
+				acc[1] += a[i + 1];
+				acc[2] += a[i + 2];
+				acc[3] += a[i + 3];
+			}
+			for (; i < n; i++) acc[0] += a[i];
+			return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+		}
+
+		float Optimized::max(size_t n, const float* a) const
+		{
+			assert(n > 0);
+			float acc[4] = { a[0], a[0], a[0], a[0] };
+			size_t i = 0;
+			for (; i + 4 <= n; i += 4)
+			{
+				acc[0] = std::max(acc[0], a[i + 0]);
+				acc[1] = std::max(acc[1], a[i + 1]);
+				acc[2] = std::max(acc[2], a[i + 2]);
+				acc[3] = std::max(acc[3], a[i + 3]);
+			}
+			for (; i < n; i++) acc[0] = std::max(acc[0], a[i]);
+			return std::max(std::max(acc[0], acc[1]), std::max(acc[2], acc[3]));
+		}
+
+		void Optimized::activate(Activation fn, size_t n, const float* in, float* out) const
+		{
+			switch (fn)
+			{
+			case Activation::Identity:
+				if (in != out) std::copy(in, in + n, out);
+				break;
+			case Activation::ReLU:
+				#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+				for (int i = 0; i < (int)n; i++) out[i] = in[i] > 0.0f ? in[i] : 0.0f;
+				break;
+			case Activation::Sigmoid:
+				#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+				for (int i = 0; i < (int)n; i++) out[i] = 1.0f / (1.0f + std::exp(-in[i]));
+				break;
+			case Activation::TanH:
+				#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+				for (int i = 0; i < (int)n; i++) out[i] = tanhf(in[i]);
+				break;
+			}
+		}
+
+		void Optimized::activateGrad(Activation fn, size_t n, const float* out, const float* gradOut, float* gradIn) const
+		{
+			// Derivatives from the output avoid recomputing exp / tanh
+			switch (fn)
+			{
+			case Activation::Identity:
+				if (gradOut != gradIn) std::copy(gradOut, gradOut + n, gradIn);
+				break;
+			case Activation::ReLU:
+				#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+				for (int i = 0; i < (int)n; i++) gradIn[i] = out[i] > 0.0f ? gradOut[i] : 0.0f;
+				break;
+			case Activation::Sigmoid:
+				#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+				for (int i = 0; i < (int)n; i++) gradIn[i] = out[i] * (1.0f - out[i]) * gradOut[i];
+				break;
+			case Activation::TanH:
+				#pragma omp parallel for if (n > PARALLEL_THRESHOLD)
+				for (int i = 0; i < (int)n; i++) gradIn[i] = (1.0f - (out[i] * out[i])) * gradOut[i];
+				break;
+			}
+		}
+
+		void Optimized::softmax(size_t m, size_t n, const float* in, float* out) const
+		{
+			// Walk column by column so every pass is contiguous over rows
+			thread_local std::vector<float> rowMax;
+			thread_local std::vector<float> rowSum;
+			rowMax.assign(in, in + m);
+			rowSum.assign(m, 0.0f);
+			for (size_t col = 1; col < n; col++)
+			{
+				const float* inCol = in + m * col;
+				for (size_t r = 0; r < m; r++) rowMax[r] = std::max(rowMax[r], inCol[r]);
+			}
+			for (size_t col = 0; col < n; col++)
+			{
+				const float* inCol = in + m * col;
+				float* outCol = out + m * col;
+				for (size_t r = 0; r < m; r++)
+				{
+					outCol[r] = std::exp(inCol[r] - rowMax[r]);
+					rowSum[r] += outCol[r];
+				}
+			}
+			for (size_t r = 0; r < m; r++) rowSum[r] = 1.0f / rowSum[r];
+			for (size_t col = 0; col < n; col++)
+			{
+				float* outCol = out + m * col;
+				for (size_t r = 0; r < m; r++) outCol[r] *= rowSum[r];
+			}
+		}
+
+		void Optimized::softmaxGrad(size_t m, size_t n, const float* out, const float* gradOut, float* gradIn) const
+		{
+			// O(n) per row instead of the O(n^2) Jacobian, contiguous column passes
+			thread_local std::vector<float> rowDot;
+			rowDot.assign(m, 0.0f);
+			for (size_t col = 0; col < n; col++)
+			{
+				const float* outCol = out + m * col;
+				const float* gradCol = gradOut + m * col;
+				for (size_t r = 0; r < m; r++) rowDot[r] += outCol[r] * gradCol[r];
+			}
+			for (size_t col = 0; col < n; col++)
+			{
+				const float* outCol = out + m * col;
+				const float* gradCol = gradOut + m * col;
+				float* gradInCol = gradIn + m * col;
+				for (size_t r = 0; r < m; r++) gradInCol[r] = outCol[r] * (gradCol[r] - rowDot[r]);
+			}
+		}
+
+		float Optimized::softmaxCrossEntropy(size_t m, size_t n, const float* logits, const float* expected, float* grad) const
+		{
+			// Exponentials are stored in grad so each is only computed once
+			thread_local std::vector<float> rowMax;
+			thread_local std::vector<float> rowSum;
+			thread_local std::vector<float> rowLogSum;
+			rowMax.assign(logits, logits + m);
+			rowSum.assign(m, 0.0f);
+			rowLogSum.resize(m);
+			for (size_t col = 1; col < n; col++)
+			{
+				const float* inCol = logits + m * col;
+				for (size_t r = 0; r < m; r++) rowMax[r] = std::max(rowMax[r], inCol[r]);
+			}
+			for (size_t col = 0; col < n; col++)
+			{
+				const float* inCol = logits + m * col;
+				float* gradCol = grad + m * col;
+				for (size_t r = 0; r < m; r++)
+				{
+					gradCol[r] = std::exp(inCol[r] - rowMax[r]);
+					rowSum[r] += gradCol[r];
+				}
+			}
+
+			// Loss from log softmax = X - max - log Σ e^(X - max), gradient = p - Y
+			for (size_t r = 0; r < m; r++)
+			{
+				rowLogSum[r] = std::log(rowSum[r]);
+				rowSum[r] = 1.0f / rowSum[r];
+			}
+			float loss = 0.0f;
+			for (size_t col = 0; col < n; col++)
+			{
+				const float* inCol = logits + m * col;
+				const float* expectedCol = expected + m * col;
+				float* gradCol = grad + m * col;
+				for (size_t r = 0; r < m; r++)
+				{
+					loss += -expectedCol[r] * (inCol[r] - rowMax[r] - rowLogSum[r]);
+					gradCol[r] = gradCol[r] * rowSum[r] - expectedCol[r];
+				}
+			}
+			return loss / m;
+		}
+
+		float Optimized::squareError(size_t n, const float* output, const float* expected, float* grad) const
+		{
+			// Blocks of split accumulators so the sum vectorizes, blocks are only spread over threads for large outputs
+			float loss = 0.0f;
+			int blockCount = (int)((n + LOSS_BLOCK - 1) / LOSS_BLOCK);
+			#pragma omp parallel for reduction(+:loss) if (n > PARALLEL_THRESHOLD)
+			for (int block = 0; block < blockCount; block++)
+			{
+				size_t end = std::min((size_t)(block + 1) * LOSS_BLOCK, n);
+				size_t i = (size_t)block * LOSS_BLOCK;
+				float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				for (; i + 4 <= end; i += 4)
+				{
+					for (size_t j = 0; j < 4; j++)
+					{
+						float diff = output[i + j] - expected[i + j];
+						grad[i + j] = diff;
+						acc[j] += diff * diff;
+					}
+				}
+				for (; i < end; i++)
+				{
+					float diff = output[i] - expected[i];
+					grad[i] = diff;
+					acc[0] += diff * diff;
+				}
+				loss += (acc[0] + acc[1]) + (acc[2] + acc[3]);
+			}
+			return loss;
+		}
+
+		float Optimized::crossEntropy(size_t n, const float* output, const float* expected, float* grad) const
+		{
+			// Zero targets add nothing to the loss so skip their log, which for one-hot targets is all but one per row
+			float loss = 0.0f;
+			#pragma omp parallel for reduction(+:loss) if (n > PARALLEL_THRESHOLD)
+			for (int i = 0; i < (int)n; i++)
+			{
+				float shifted = output[i] + 1e-15f;
+				grad[i] = -expected[i] / shifted;
+				if (expected[i] != 0.0f) loss += -expected[i] * std::log(shifted);
+			}
+			return loss;
+		}
+
+		void Optimized::argmaxRows(size_t m, size_t n, const float* a, uint32_t* out) const
+		{
+			// Walk contiguous columns over a block of rows, each compare and select runs across rows
+			// Selects are branch free masks so the loop vectorizes with plain SSE2 and random data does not mispredict
+			int blockCount = (int)((m + ARGMAX_ROW_BLOCK - 1) / ARGMAX_ROW_BLOCK);
+			#pragma omp parallel for if (m * n > PARALLEL_THRESHOLD)
+			for (int block = 0; block < blockCount; block++)
+			{
+				size_t row0 = (size_t)block * ARGMAX_ROW_BLOCK;
+				size_t rows = std::min(ARGMAX_ROW_BLOCK, m - row0);
+				float maxValues[ARGMAX_ROW_BLOCK];
+				uint32_t indices[ARGMAX_ROW_BLOCK] = {};
+				std::copy(a + row0, a + row0 + rows, maxValues);
+				for (size_t col = 1; col < n; col++)
+				{
+					const float* column = a + m * col + row0;
+					for (size_t r = 0; r < rows; r++)
+					{
+						uint32_t mask = 0u - (uint32_t)(column[r] > maxValues[r]);
+						maxValues[r] = column[r] > maxValues[r] ? column[r] : maxValues[r];
+						indices[r] = (indices[r] & ~mask) | ((uint32_t)col & mask);
+					}
+				}
+				std::copy(indices, indices + rows, out + row0);
+			}
+		}
+
+		void Optimized::im2col(const ConvShape& conv, size_t batch, const float* input, float* columns) const
+		{
+			// Samples are the fastest index of both input and columns so every pixel moves as a contiguous run of batch floats
+			// With stride 1 neighbouring output pixels read neighbouring input pixels and a whole row is one block copy
+			size_t outHeight = conv.getOutHeight();
+			size_t outWidth = conv.getOutWidth();
+			size_t rows = batch * outHeight * outWidth;
+			int patchSize = (int)conv.getPatchSize();
+			#pragma omp parallel for if (rows * patchSize > PARALLEL_THRESHOLD)
+			for (int col = 0; col < patchSize; col++)
+			{
+				size_t c = col / (conv.kernel * conv.kernel);
+				size_t ky = (col / conv.kernel) % conv.kernel;
+				size_t kx = col % conv.kernel;
+				size_t y0, y1, x0, x1;
+				getConvRange(conv.height, outHeight, ky, conv.stride, conv.padding, y0, y1);
+				getConvRange(conv.width, outWidth, kx, conv.stride, conv.padding, x0, x1);
+				float* column = columns + rows * col;
+				for (size_t y = 0; y < outHeight; y++)
+				{
+					float* out = column + batch * outWidth * y;
+					if (y < y0 || y >= y1)
+					{
+						std::fill(out, out + batch * outWidth, 0.0f);
+						continue;
+					}
+
+					size_t iy = y * conv.stride + ky - conv.padding;
+					const float* in = input + batch * (c * conv.height * conv.width + iy * conv.width);
+					std::fill(out, out + batch * x0, 0.0f);
+					if (conv.stride == 1)
+					{
+						const float* from = in + batch * (x0 + kx - conv.padding);
+						std::copy(from, from + batch * (x1 - x0), out + batch * x0);
+					}
+					else
+					{
+						for (size_t x = x0; x < x1; x++)
+						{
+							const float* from = in + batch * (x * conv.stride + kx - conv.padding);
+							std::copy(from, from + batch, out + batch * x);
+						}
+					}
+					std::fill(out + batch * x1, out + batch * outWidth, 0.0f);
+				}
+			}
+		}
+
+		void Optimized::col2im(const ConvShape& conv, size_t batch, const float* columns, float* gradInput) const
+		{
+			// Each channel's pixels are only written from its own patch columns so threads split channels race free
+			// Within a channel columns are added in a fixed order so results do not depend on the thread count
+			size_t outHeight = conv.getOutHeight();
+			size_t outWidth = conv.getOutWidth();
+			size_t rows = batch * outHeight * outWidth;
+			size_t channelSize = batch * conv.height * conv.width;
+			size_t kernelArea = conv.kernel * conv.kernel;
+			#pragma omp parallel for if (rows * conv.getPatchSize() > PARALLEL_THRESHOLD)
+			for (int c = 0; c < (int)conv.channels; c++)
+			{
+				float* channel = gradInput + channelSize * c;
+				std::fill(channel, channel + channelSize, 0.0f);
+				for (size_t k = 0; k < kernelArea; k++)
+				{
+					size_t ky = k / conv.kernel;
+					size_t kx = k % conv.kernel;
+					size_t y0, y1, x0, x1;
+					getConvRange(conv.height, outHeight, ky, conv.stride, conv.padding, y0, y1);
+					getConvRange(conv.width, outWidth, kx, conv.stride, conv.padding, x0, x1);
+					const float* column = columns + rows * (kernelArea * c + k);
+					for (size_t y = y0; y < y1; y++)
+					{
+						const float* in = column + batch * outWidth * y;
+						float* out = channel + batch * conv.width * (y * conv.stride + ky - conv.padding);
+						if (conv.stride == 1)
+						{
+							const float* from = in + batch * x0;
+							float* to = out + batch * (x0 + kx - conv.padding);
+							for (size_t i = 0; i < batch * (x1 - x0); i++) to[i] += from[i];
+						}
+						else
+						{
+							for (size_t x = x0; x < x1; x++)
+							{
+								const float* from = in + batch * x;
+								float* to = out + batch * (x * conv.stride + kx - conv.padding);
+								for (size_t n = 0; n < batch; n++) to[n] += from[n];
+							}
+						}
+					}
+				}
+			}
+		}
+
+#ifdef TBML_USE_CBLAS
+		void Blas::gemm(bool transA, bool transB, size_t m, size_t n, size_t k, float alpha, const float* a, const float* b, float beta, float* c) const
+		{
+			cblas_sgemm(
+				CblasColMajor, transA ? CblasTrans : CblasNoTrans, transB ? CblasTrans : CblasNoTrans,
+				(int)m, (int)n, (int)k, alpha, a, transA ? (int)k : (int)m, b, transB ? (int)n : (int)k, beta, c, (int)m);
+		}
+
+		void Blas::gemv(size_t n, size_t k, const float* x, const float* w, const float* bias, Activation fn, float* y) const
+		{
+			// y = fn(w^T x + bias)
+			for (size_t col = 0; col < n; col++) y[col] = bias != nullptr ? bias[col] : 0.0f;
+			cblas_sgemv(CblasColMajor, CblasTrans, (int)k, (int)n, 1.0f, w, (int)k, x, 1, 1.0f, y, 1);
+			activate(fn, n, y, y);
+		}
+
+		void Blas::axpby(size_t n, float alpha, const float* x, float beta, float* y) const
+		{
+			// sscal by 0 keeps stale Inf or NaN in y, so beta 0 copies x instead
+			if (beta == 0.0f)
+			{
+				cblas_scopy((int)n, x, 1, y, 1);
+				cblas_sscal((int)n, alpha, y, 1);
+				return;
+			}
+			cblas_sscal((int)n, beta, y, 1);
+			cblas_saxpy((int)n, alpha, x, 1, y, 1);
+		}
+#endif
+	}
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tbml
+{
+	namespace backend
+	{
+		enum class Activation { Identity, ReLU, Sigmoid, TanH };
+
+		// Column width of packed GEMM panels, see PackedMatrix
+		const size_t PANEL_WIDTH = 4;
+
+		// Pack b (rows x cols) into panels, packed must hold ceil(cols / PANEL_WIDTH) * PANEL_WIDTH * rows
+		// If transposed then b is stored as (cols x rows) and its transpose is packed
+		void packPanels(size_t rows, size_t cols, const float* b, float* packed, bool transposed = false);
+
+		// Square kernel convolution over channels of (height x width) images, see Base::im2col
+		struct ConvShape
+		{
+			size_t channels = 1;
+			size_t height = 1;
+			size_t width = 1;
+			size_t kernel = 1;
+			size_t stride = 1;
+			size_t padding = 0;
+
+			size_t getOutHeight() const { return (height + 2 * padding - kernel) / stride + 1; }
+			size_t getOutWidth() const { return (width + 2 * padding - kernel) / stride + 1; }
+			size_t getInputSize() const { return channels * height * width; }
+			size_t getPatchSize() const { return channels * kernel * kernel; }
+		};
+
+		// Raw float kernels used by Tensor, all matrices column-major
+		// Packed matrices use the PackedMatrix panel layout from Tensor.h
+		class Base
+		{
+		public:
+			Base() = default;
+			virtual ~Base() = default;
+			Base(const Base&) = delete;
+			Base& operator=(const Base&) = delete;
+
+			virtual std::string getName() const = 0;
+
+			// c (m x n) = alpha * op(a) (m x k) * op(b) (k x n) + beta * c, c is not read when beta is 0
+			// op(x) = x^T when trans is set, otherwise x, each element of c is reduced in a fixed order
+			virtual void gemm(bool transA, bool transB, size_t m, size_t n, size_t k, float alpha, const float* a, const float* b, float beta, float* c) const = 0;
+			virtual void gemmPacked(size_t m, size_t n, size_t k, float alpha, const float* a, const float* bPacked, float beta, float* c) const = 0;
+
+			// c (m x n) = fn(a (m x k) * b (k x n) + bias) with bias (1 x n) added to every row, bias can be nullptr
+			virtual void gemmBiasActivate(size_t m, size_t n, size_t k, const float* a, const float* bPacked, const float* bias, Activation fn, float* c) const = 0;
+
+			// As gemmBiasActivate with b unpacked, gemm then the bias and activation epilogue
+			// Layers use this instead when prefersUnpackedWeights, e.g. a BLAS library packs b itself
+			virtual void gemmBiasActivateUnpacked(size_t m, size_t n, size_t k, const float* a, const float* b, const float* bias, Activation fn, float* c) const;
+			virtual bool prefersUnpackedWeights() const { return false; }
+
+			// y (1 x n) = fn(x (1 x k) * w (k x n) + bias), bias can be nullptr
+			virtual void gemv(size_t n, size_t k, const float* x, const float* w, const float* bias, Activation fn, float* y) const = 0;
+
+			// c (m x n) = fn(a (m x k) * b (k x n) + bias) with b compressed by column, see SparseMatrix in Tensor.h
+			// Column j of b is values[colStarts[j], colStarts[j + 1]) at rows rowIndices[...], bias can be nullptr
+			virtual void sparseGemmBiasActivate(size_t m, size_t n, const float* a, const uint32_t* colStarts, const uint32_t* rowIndices, const float* values, const float* bias, Activation fn, float* c) const = 0;
+
+			// a[i] = a[i] op b[i]
+			virtual void add(size_t n, float* a, const float* b) const = 0;
+			virtual void sub(size_t n, float* a, const float* b) const = 0;
+			virtual void mult(size_t n, float* a, const float* b) const = 0;
+			virtual void div(size_t n, float* a, const float* b) const = 0;
+
+			// a[i] = a[i] op v
+			virtual void add(size_t n, float* a, float v) const = 0;
+			virtual void mult(size_t n, float* a, float v) const = 0;
+			virtual void div(size_t n, float* a, float v) const = 0;
+
+			// y[i] = alpha * x[i] + beta * y[i], y is not read when beta is 0
+			virtual void axpby(size_t n, float alpha, const float* x, float beta, float* y) const = 0;
+
+			// y[i] = alpha * a[i] * b[i] + beta * y[i], y is not read when beta is 0
+			virtual void multAcc(size_t n, float alpha, const float* a, const float* b, float beta, float* y) const = 0;
+
+			// Optimizer updates fused into one pass over each element
+			// momentum = momentumRate * momentum - learningRate * grad, param += momentum
+			virtual void sgdMomentum(size_t n, float learningRate, float momentumRate, const float* grad, float* momentum, float* param) const = 0;
+
+			// Adam step t >= 1 with bias corrected moments m and v, weightDecay shrinks param decoupled from the gradient (AdamW)
+			virtual void adam(size_t n, float learningRate, float beta1, float beta2, float epsilon, float weightDecay, size_t t, const float* grad, float* m, float* v, float* param) const = 0;
+
+			// out (1 x n) = alpha * Σ rows of a (m x n) + beta * out, out is not read when beta is 0
+			virtual void sumRows(size_t m, size_t n, float alpha, const float* a, float beta, float* out) const = 0;
+
+			// a (m x n) += row (1 x n) for every row
+			virtual void addRows(size_t m, size_t n, float* a, const float* row) const = 0;
+
+			virtual float sum(size_t n, const float* a) const = 0;
+			virtual float max(size_t n, const float* a) const = 0;
+
+			// out = fn(in), in and out can alias
+			virtual void activate(Activation fn, size_t n, const float* in, float* out) const = 0;
+
+			// gradIn = fn'(in) * gradOut computed from out = fn(in) so the input need not be kept
+			virtual void activateGrad(Activation fn, size_t n, const float* out, const float* gradOut, float* gradIn) const = 0;
+
+			// Softmax of each row of in (m x n) into out, in and out can alias
+			virtual void softmax(size_t m, size_t n, const float* in, float* out) const = 0;
+
+			// gradIn = out * (gradOut - Σ out * gradOut) per row, the softmax Jacobian product without forming it
+			virtual void softmaxGrad(size_t m, size_t n, const float* out, const float* gradOut, float* gradIn) const = 0;
+
+			// grad = softmax(logits) - expected, returns mean over rows of -Σ expected * log softmax(logits)
+			// Log-sum-exp keeps the loss finite where probabilities underflow, rows of expected must sum to 1
+			virtual float softmaxCrossEntropy(size_t m, size_t n, const float* logits, const float* expected, float* grad) const = 0;
+
+			// grad = output - expected, returns Σ (output - expected)^2
+			virtual float squareError(size_t n, const float* output, const float* expected, float* grad) const = 0;
+
+			// grad = -expected / (output + 1e-15), returns Σ -expected * log(output + 1e-15)
+			virtual float crossEntropy(size_t n, const float* output, const float* expected, float* grad) const = 0;
+
+			// Column of the largest value in each row of a (m x n), the first on ties
+			virtual void argmaxRows(size_t m, size_t n, const float* a, uint32_t* out) const = 0;
+
+			// Lower a convolution of input (batch x channels * height * width) to one GEMM
+			// columns ((batch * outHeight * outWidth) x patch size) has row n + batch * (y * outWidth + x) hold the patch under output pixel (y, x) of sample n
+			// Patch values are ordered (channel, ky, kx) and are 0 where the kernel overlaps padding
+			virtual void im2col(const ConvShape& conv, size_t batch, const float* input, float* columns) const = 0;
+
+			// gradInput (batch x channels * height * width) = Σ of columns into the pixels they were gathered from, the adjoint of im2col
+			virtual void col2im(const ConvShape& conv, size_t batch, const float* columns, float* gradInput) const = 0;
+		};
+
+		using BasePtr = std::shared_ptr<Base>;
+
+		// Straightforward loops, kept as the ground truth to A/B against
+		class Reference : public Base
+		{
+		public:
+			std::string getName() const override { return "reference"; }
+			void gemm(bool transA, bool transB, size_t m, size_t n, size_t k, float alpha, const float* a, const float* b, float beta, float* c) const override;
+			void gemmPacked(size_t m, size_t n, size_t k, float alpha, const float* a, const float* bPacked, float beta, float* c) const override;
+			void gemmBiasActivate(size_t m, size_t n, size_t k, const float* a, const float* bPacked, const float* bias, Activation fn, float* c) const override;
+			void gemv(size_t n, size_t k, const float* x, const float* w, const float* bias, Activation fn, float* y) const override;
+			void sparseGemmBiasActivate(size_t m, size_t n, const float* a, const uint32_t* colStarts, const uint32_t* rowIndices, const float* values, const float* bias, Activation fn, float* c) const override;
+			void add(size_t n, float* a, const float* b) const override;
+			void sub(size_t n, float* a, const float* b) const override;
+			void mult(size_t n, float* a, const float* b) const override;
+			void div(size_t n, float* a, const float* b) const override;
+			void add(size_t n, float* a, float v) const override;
+			void mult(size_t n, float* a, float v) const override;
+			void div(size_t n, float* a, float v) const override;
+			void axpby(size_t n, float alpha, const float* x, float beta, float* y) const override;
+			void multAcc(size_t n, float alpha, const float* a, const float* b, float beta, float* y) const override;
+			void sgdMomentum(size_t n, float learningRate, float momentumRate, const float* grad, float* momentum, float* param) const override;
+			void adam(size_t n, float learningRate, float beta1, float beta2, float epsilon, float weightDecay, size_t t, const float* grad, float* m, float* v, float* param) const override;
+			void sumRows(size_t m, size_t n, float alpha, const float* a, float beta, float* out) const override;
+			void addRows(size_t m, size_t n, float* a, const float* row) const override;
+			float sum(size_t n, const float* a) const override;
+			float max(size_t n, const float* a) const override;
+			void activate(Activation fn, size_t n, const float* in, float* out) const override;
+			void activateGrad(Activation fn, size_t n, const float* out, const float* gradOut, float* gradIn) const override;
+			void softmax(size_t m, size_t n, const float* in, float* out) const override;
+			void softmaxGrad(size_t m, size_t n, const float* out, const float* gradOut, float* gradIn) const override;
+			float softmaxCrossEntropy(size_t m, size_t n, const float* logits, const float* expected, float* grad) const override;
+			float squareError(size_t n, const float* output, const float* expected, float* grad) const override;
+			float crossEntropy(size_t n, const float* output, const float* expected, float* grad) const override;
+			void argmaxRows(size_t m, size_t n, const float* a, uint32_t* out) const override;
+			void im2col(const ConvShape& conv, size_t batch, const float* input, float* columns) const override;
+			void col2im(const ConvShape& conv, size_t batch, const float* columns, float* gradInput) const override;
+		};
+
+		// Register tiled packed GEMM, split accumulators and OpenMP over large inputs
+		class Optimized : public Base
+		{
+		public:
+			std::string getName() const override { return "optimized"; }
+			void gemm(bool transA, bool transB, size_t m, size_t n, size_t k, float alpha, const float* a, const float* b, float beta, float* c) const override;
+			void gemmPacked(size_t m, size_t n, size_t k, float alpha, const float* a, const float* bPacked, float beta, float* c) const override;
+			void gemmBiasActivate(size_t m, size_t n, size_t k, const float* a, const float* bPacked, const float* bias, Activation fn, float* c) const override;
+			void gemv(size_t n, size_t k, const float* x, const float* w, const float* bias, Activation fn, float* y) const override;
+			void sparseGemmBiasActivate(size_t m, size_t n, const float* a, const uint32_t* colStarts, const uint32_t* rowIndices, const float* values, const float* bias, Activation fn, float* c) const override;
+			void add(size_t n, float* a, const float* b) const override;
+			void sub(size_t n, float* a, const float* b) const override;
+			void mult(size_t n, float* a, const float* b) const override;
+			void div(size_t n, float* a, const float* b) const override;
+			void add(size_t n, float* a, float v) const override;
+			void mult(size_t n, float* a, float v) const override;
+			void div(size_t n, float* a, float v) const override;
+			void axpby(size_t n, float alpha, const float* x, float beta, float* y) const override;
+			void multAcc(size_t n, float alpha, const float* a, const float* b, float beta, float* y) const override;
+			void sgdMomentum(size_t n, float learningRate, float momentumRate, const float* grad, float* momentum, float* param) const override;
+			void adam(size_t n, float learningRate, float beta1, float beta2, float epsilon, float weightDecay, size_t t, const float* grad, float* m, float* v, float* param) const override;
+			void sumRows(size_t m, size_t n, float alpha, const float* a, float beta, float* out) const override;
+			void addRows(size_t m, size_t n, float* a, const float* row) const override;
+			float sum(size_t n, const float* a) const override;
+			float max(size_t n, const float* a) const override;
+			void activate(Activation fn, size_t n, const float* in, float* out) const override;
+			void activateGrad(Activation fn, size_t n, const float* out, const float* gradOut, float* gradIn) const override;
+			void softmax(size_t m, size_t n, const float* in, float* out) const override;
+			void softmaxGrad(size_t m, size_t n, const float* out, const float* gradOut, float* gradIn) const override;
+			float softmaxCrossEntropy(size_t m, size_t n, const float* logits, const float* expected, float* grad) const override;
+			float squareError(size_t n, const float* output, const float* expected, float* grad) const override;
+			float crossEntropy(size_t n, const float* output, const float* expected, float* grad) const override;
+			void argmaxRows(size_t m, size_t n, const float* a, uint32_t* out) const override;
+			void im2col(const ConvShape& conv, size_t batch, const float* input, float* columns) const override;
+			void col2im(const ConvShape& conv, size_t batch, const float* columns, float* gradInput) const override;
+		};
+
+#ifdef TBML_USE_CBLAS
+		// Optimized with GEMM / GEMV from a system CBLAS, requires linking one
+		class Blas : public Optimized
+		{
+		public:
+			std::string getName() const override { return "blas"; }
+			bool prefersUnpackedWeights() const override { return true; }
+			void gemm(bool transA, bool transB, size_t m, size_t n, size_t k, float alpha, const float* a, const float* b, float beta, float* c) const override;
+			void gemv(size_t n, size_t k, const float* x, const float* w, const float* bias, Activation fn, float* y) const override;
+			void axpby(size_t n, float alpha, const float* x, float beta, float* y) const override;
+		};
+#endif
+
+		// Currently selected backend, initially $TBML_BACKEND or "optimized"
+		const Base& get();
+
+		// Select a registered backend by name, returns false if not found
+		bool setBackend(const std::string& name);
+
+		void registerBackend(BasePtr backend);
+		std::vector<std::string> getBackendNames();
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+namespace tbml
+{
+	// Blocking FIFO between threads, push waits while full and pop waits while empty
+	template<typename T>
+	class BoundedQueue
+	{
+	public:
+		BoundedQueue(size_t capacity) : capacity(capacity) {}
+		BoundedQueue(const BoundedQueue&) = delete;
+		BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+		void push(T value)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				notFull.wait(lock, [this] { return items.size() < capacity; });
+				items.push(std::move(value));
+			}
+			notEmpty.notify_one();
+		}
+
+		T pop()
+		{
+			T value;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				notEmpty.wait(lock, [this] { return !items.empty(); });
+				value = std::move(items.front());
+				items.pop();
+			}
+			notFull.notify_one();
+			return value;
+		}
+
+		size_t getCapacity() const { return capacity; }
+
+	private:
+		const size_t capacity;
+		std::queue<T> items;
+		std::mutex mutex;
+		std::condition_variable notEmpty;
+		std::condition_variable notFull;
+	};
+}
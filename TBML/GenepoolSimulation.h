@@ -3,6 +3,7 @@
 #include <numeric>
 #include "Utility.h"
 #include "ThreadPool.h"
+#include "Trace.h"
 
 // Require SFML to be imported
 // TODO: Figure out if this is best way
@@ -117,6 +118,7 @@ namespace tbml
 			{
 				if (!this->isGenepoolInitialized) throw std::runtime_error("tbml::GenepoolSimulation: Cannot evaluateGeneration because uninitialized.");
 				if (this->isGenerationEvaluated) return;
+				trace::Scope scope("Genepool::evaluateGeneration", "generation", this->currentGeneration);
 
 				// Process generation (multi-threaded)
 				if ((this->useThreadedStep && singleStep) || (this->useThreadedFullStep && !singleStep))
@@ -177,6 +179,7 @@ namespace tbml
 			{
 				if (!this->isGenepoolInitialized) throw std::runtime_error("tbml::GenepoolSimulation: Cannot iterateGeneration because uninitialized.");
 				if (!this->isGenerationEvaluated) return;
+				trace::Scope scope("Genepool::iterateGeneration", "generation", this->currentGeneration);
 
 				// Sort generation and extract best agent
 				std::sort(this->agentPopulation.begin(), this->agentPopulation.end(), [this](const auto& a, const auto& b) { return a->getFitness() > b->getFitness(); });
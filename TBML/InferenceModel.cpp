@@ -0,0 +1,110 @@
+#include "stdafx.h"
+#include "InferenceModel.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		InferenceModel::InferenceModel(std::vector<Op>&& ops)
+			: ops(std::move(ops))
+		{
+			if (this->ops.size() == 0) return;
+
+			// Elementwise ops take their width from the op before, so plan shapes once here instead of per call
+			size_t width = 0;
+			for (size_t i = 0; i < this->ops.size(); i++)
+			{
+				Op& op = this->ops[i];
+				if (op.type == Op::Type::Dense)
+				{
+					if (width != 0 && width != op.inputSize) throw std::runtime_error("Dense input size does not match previous layer");
+					if (inputSize == 0) inputSize = op.inputSize;
+					width = op.outputSize;
+				}
+				else
+				{
+					op.inputSize = width;
+					op.outputSize = width;
+				}
+				scratchRowSize = std::max(scratchRowSize, width);
+			}
+			if (inputSize == 0) throw std::runtime_error("Cannot compile a network without Dense layers");
+
+			// Elementwise ops before the first Dense run at its input size
+			for (size_t i = 0; i < this->ops.size() && this->ops[i].type != Op::Type::Dense; i++)
+			{
+				this->ops[i].inputSize = inputSize;
+				this->ops[i].outputSize = inputSize;
+			}
+			scratchRowSize = std::max(scratchRowSize, inputSize);
+			outputSize = width;
+		}
+
+		void InferenceModel::propogate(const float* input, size_t rows, float* output) const
+		{
+			if (ops.size() == 0) return;
+
+			// Scratch is per thread and only grows, so after the first call nothing allocates
+			thread_local std::vector<float> scratch;
+			size_t half = scratchRowSize * rows;
+			if (scratch.size() < 2 * half) scratch.resize(2 * half);
+
+			// Each op reads the previous result and writes the other half, the last writes into output
+			const backend::Base& backend = backend::get();
+			const float* current = input;
+			for (size_t i = 0; i < ops.size(); i++)
+			{
+				const Op& op = ops[i];
+				float* next = (i + 1 == ops.size()) ? output : scratch.data() + (i % 2) * half;
+				switch (op.type)
+				{
+				case Op::Type::Dense:
+				{
+					const float* bias = op.bias.getSize() > 0 ? op.bias.getData().data() : nullptr;
+					const SparseMatrix& sparse = op.sparseWeights;
+					if (sparse.isFasterFor(rows)) backend.sparseGemmBiasActivate(rows, op.outputSize, current, sparse.colStarts.data(), sparse.rowIndices.data(), sparse.values.data(), bias, op.fn, next);
+					else if (rows == 1) backend.gemv(op.outputSize, op.inputSize, current, op.weights.getData().data(), bias, op.fn, next);
+					else if (backend.prefersUnpackedWeights()) backend.gemmBiasActivateUnpacked(rows, op.outputSize, op.inputSize, current, op.weights.getData().data(), bias, op.fn, next);
+					else backend.gemmBiasActivate(rows, op.outputSize, op.inputSize, current, op.packedWeights.data.data(), bias, op.fn, next);
+					break;
+				}
+				case Op::Type::Activation:
+					backend.activate(op.fn, rows * op.outputSize, current, next);
+					break;
+				case Op::Type::Softmax:
+					backend.softmax(rows, op.outputSize, current, next);
+					break;
+				}
+				current = next;
+			}
+		}
+
+		Tensor InferenceModel::propogate(const Tensor& input) const
+		{
+			if (ops.size() == 0) return Tensor(Tensor::ZERO);
+			if (input.getDims() != 2 || input.getShape(1) != inputSize) throw std::runtime_error("Input shape does not match model input size");
+
+			size_t rows = input.getShape(0);
+			std::vector<float> output(rows * outputSize);
+			propogate(input.getData().data(), rows, output.data());
+			return Tensor({ rows, outputSize }, std::move(output));
+		}
+
+		void InferenceModel::propogate(const Tensor& input, Tensor& output) const
+		{
+			if (ops.size() == 0) throw std::runtime_error("Cannot propogate through an empty model");
+			if (input.getDims() != 2 || input.getShape(1) != inputSize) throw std::runtime_error("Input shape does not match model input size");
+			assert(&input != &output);
+
+			// Writes into output's storage, so callers looping over same sized batches allocate nothing after the first
+			size_t rows = input.getShape(0);
+			propogate(input.getData().data(), rows, output.prepareOverwrite({ rows, outputSize }));
+		}
+
+		void InferenceModel::propogateMut(Tensor& input) const
+		{
+			if (ops.size() == 0) return;
+			input = propogate(input);
+		}
+	}
+}
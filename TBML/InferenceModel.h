@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include "Tensor.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		// Frozen forward only copy of a NeuralNetwork, see NeuralNetwork::compileForInference
+		// Dense + activation pairs are fused, weights prepacked and layer dispatch is a switch over ops
+		// Immutable after construction so one model can be shared by any number of threads
+		// Each thread ping-pongs between two halves of its own scratch arena, sized to the widest op
+		class InferenceModel
+		{
+		public:
+			struct Op
+			{
+				enum class Type { Dense, Activation, Softmax };
+
+				Type type;
+				backend::Activation fn = backend::Activation::Identity;
+				size_t inputSize = 0;
+				size_t outputSize = 0;
+
+				// Dense only, weights are shared copy-on-write with the source layer
+				// Sparse enough weights are compressed instead of packed
+				Tensor weights;
+				Tensor bias;
+				PackedMatrix packedWeights;
+				SparseMatrix sparseWeights;
+			};
+
+			InferenceModel() {}
+			InferenceModel(std::vector<Op>&& ops);
+
+			// output (rows x outputSize) = model(input (rows x inputSize)), column-major like Tensor
+			void propogate(const float* input, size_t rows, float* output) const;
+			Tensor propogate(const Tensor& input) const;
+			void propogate(const Tensor& input, Tensor& output) const;
+			void propogateMut(Tensor& input) const;
+
+			size_t getInputSize() const { return inputSize; }
+			size_t getOutputSize() const { return outputSize; }
+			size_t getScratchSize(size_t rows) const { return 2 * scratchRowSize * rows; }
+			const std::vector<Op>& getOps() const { return ops; }
+			bool isEmpty() const { return ops.empty(); }
+
+		private:
+			std::vector<Op> ops;
+			size_t inputSize = 0;
+			size_t outputSize = 0;
+			size_t scratchRowSize = 0;
+		};
+	}
+}
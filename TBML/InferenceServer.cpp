@@ -0,0 +1,190 @@
+#include "stdafx.h"
+#include "InferenceServer.h"
+#include "Trace.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		void InferenceServer::Stats::print() const
+		{
+			printf("%zd requests in %zd batches (mean %.1f), p50 %.3fms, p99 %.3fms, max %.3fms, %.0f requests/s\n",
+				requests, batches, meanBatchSize, p50Ms, p99Ms, maxMs, requestsPerSecond);
+		}
+
+		InferenceServer::InferenceServer(InferenceModel&& model, const ServerConfig& config)
+			: model(std::move(model)), config(config)
+		{
+			if (this->model.isEmpty()) throw std::runtime_error("Cannot serve an empty model");
+			if (config.maxBatchSize == 0) throw std::runtime_error("maxBatchSize must be at least 1");
+			if (config.workerCount == 0) throw std::runtime_error("workerCount must be at least 1");
+
+			for (size_t i = 0; i < config.workerCount; i++) workers.emplace_back([this] { runWorker(); });
+		}
+
+		InferenceServer::~InferenceServer()
+		{
+			stop();
+		}
+
+		std::future<std::vector<float>> InferenceServer::submit(std::vector<float>&& input)
+		{
+			if (input.size() != model.getInputSize()) throw std::runtime_error("Request size does not match model input size");
+
+			Request request;
+			request.input = std::move(input);
+			request.submitted = Clock::now();
+			std::future<std::vector<float>> result = request.result.get_future();
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				if (stopping) throw std::runtime_error("submit on stopped InferenceServer");
+				queue.push_back(std::move(request));
+
+				// Only wake a worker when it has something new to decide on, a full batch or its first request
+				if (queue.size() != 1 && queue.size() != config.maxBatchSize) return result;
+			}
+			queueCondition.notify_one();
+			return result;
+		}
+
+		void InferenceServer::stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				if (stopping && workers.empty()) return;
+				stopping = true;
+			}
+			queueCondition.notify_all();
+			for (std::thread& worker : workers) worker.join();
+			workers.clear();
+		}
+
+		InferenceServer::Stats InferenceServer::getStats() const
+		{
+			std::vector<double> sorted;
+			Stats stats;
+			double seconds;
+			{
+				std::lock_guard<std::mutex> lock(statsMutex);
+				sorted = latencies;
+				stats.batches = batchCount;
+				seconds = std::chrono::duration<double>(statsEnd - statsStart).count();
+			}
+			stats.requests = sorted.size();
+			if (sorted.size() == 0) return stats;
+
+			// Nearest rank percentiles
+			std::sort(sorted.begin(), sorted.end());
+			auto percentile = [&](double p) { return sorted[std::min(sorted.size() - 1, (size_t)std::ceil(p * sorted.size()) - 1)]; };
+			stats.meanBatchSize = (double)stats.requests / stats.batches;
+			stats.p50Ms = percentile(0.50) * 1000.0;
+			stats.p99Ms = percentile(0.99) * 1000.0;
+			stats.maxMs = sorted.back() * 1000.0;
+			stats.requestsPerSecond = seconds > 0.0 ? stats.requests / seconds : 0.0;
+			return stats;
+		}
+
+		void InferenceServer::resetStats()
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			latencies.clear();
+			batchCount = 0;
+		}
+
+		void InferenceServer::runWorker()
+		{
+			// Reused between batches
+			std::vector<Request> batch;
+			std::vector<float> input;
+			std::vector<float> output;
+			batch.reserve(config.maxBatchSize);
+			input.reserve(config.maxBatchSize * model.getInputSize());
+			output.reserve(config.maxBatchSize * model.getOutputSize());
+
+			while (collectBatch(batch))
+			{
+				runBatch(batch, input, output);
+				batch.clear();
+			}
+		}
+
+		bool InferenceServer::collectBatch(std::vector<Request>& batch)
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			do
+			{
+				queueCondition.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (queue.empty()) return false;
+
+				// Wait for a full batch until the oldest request runs out of budget, when stopping take what is there
+				// Another worker may take the requests meanwhile, then start again
+				Clock::time_point deadline = queue.front().submitted + config.maxLatency;
+				queueCondition.wait_until(lock, deadline, [this] { return stopping || queue.size() >= config.maxBatchSize; });
+			}
+			while (queue.empty());
+
+			size_t rows = std::min(queue.size(), config.maxBatchSize);
+			for (size_t i = 0; i < rows; i++)
+			{
+				batch.push_back(std::move(queue.front()));
+				queue.pop_front();
+			}
+
+			// Leftovers start their own budget with another worker
+			bool wakeOther = !queue.empty();
+			lock.unlock();
+			if (wakeOther) queueCondition.notify_one();
+			return true;
+		}
+
+		void InferenceServer::runBatch(std::vector<Request>& batch, std::vector<float>& input, std::vector<float>& output)
+		{
+			size_t rows = batch.size();
+			size_t inputSize = model.getInputSize();
+			size_t outputSize = model.getOutputSize();
+			trace::Scope scope("InferenceServer batch", "rows", (int64_t)rows);
+
+			// Gather rows into a column-major batch, row r of column c is at r + c * rows
+			input.resize(rows * inputSize);
+			for (size_t r = 0; r < rows; r++)
+			{
+				const float* row = batch[r].input.data();
+				for (size_t c = 0; c < inputSize; c++) input[r + c * rows] = row[c];
+			}
+
+			// One forward for the whole batch, a failure fails every request in it
+			output.resize(rows * outputSize);
+			try
+			{
+				model.propogate(input.data(), rows, output.data());
+			}
+			catch (...)
+			{
+				for (Request& request : batch) request.result.set_exception(std::current_exception());
+				return;
+			}
+
+			// Record stats before any result is set so a caller seeing its result also sees it counted
+			Clock::time_point now = Clock::now();
+			{
+				std::lock_guard<std::mutex> lock(statsMutex);
+				if (latencies.empty()) statsStart = batch[0].submitted;
+				for (const Request& request : batch)
+				{
+					latencies.push_back(std::chrono::duration<double>(now - request.submitted).count());
+					statsStart = std::min(statsStart, request.submitted);
+				}
+				statsEnd = now;
+				batchCount++;
+			}
+
+			// Scatter results back
+			for (size_t r = 0; r < rows; r++)
+			{
+				std::vector<float> result(outputSize);
+				for (size_t c = 0; c < outputSize; c++) result[c] = output[r + c * rows];
+				batch[r].result.set_value(std::move(result));
+			}
+		}
+	}
+}
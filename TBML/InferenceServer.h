@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "InferenceModel.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		struct ServerConfig
+		{
+			// Requests coalesced into one forward at most
+			size_t maxBatchSize = 64;
+
+			// Longest a request waits in the queue for others to batch with
+			// 0 runs whatever is queued as soon as a worker is free
+			std::chrono::microseconds maxLatency{ 1000 };
+
+			// Threads each collecting and running batches, more than 1 collects the next batch while one runs
+			size_t workerCount = 1;
+		};
+
+		// Coalesces single row requests from any number of threads into micro-batches
+		// A batch runs once it is full or its oldest request has waited maxLatency, then results are scattered back
+		class InferenceServer
+		{
+		public:
+			using Clock = std::chrono::steady_clock;
+
+			struct Stats
+			{
+				size_t requests = 0;
+				size_t batches = 0;
+				double meanBatchSize = 0.0;
+				double p50Ms = 0.0;
+				double p99Ms = 0.0;
+				double maxMs = 0.0;
+				double requestsPerSecond = 0.0;
+
+				void print() const;
+			};
+
+			InferenceServer(InferenceModel&& model, const ServerConfig& config);
+			~InferenceServer();
+			InferenceServer(const InferenceServer&) = delete;
+			InferenceServer& operator=(const InferenceServer&) = delete;
+
+			// Input is one row of getInputSize() values, the future gets one row of getOutputSize()
+			std::future<std::vector<float>> submit(std::vector<float>&& input);
+			std::vector<float> predict(std::vector<float>&& input) { return submit(std::move(input)).get(); }
+
+			// Finish queued requests then join workers, submit throws afterwards
+			void stop();
+
+			// Latency is from submit until the batch finishes, throughput over the time since the first request
+			Stats getStats() const;
+			void resetStats();
+
+			const InferenceModel& getModel() const { return model; }
+			const ServerConfig& getConfig() const { return config; }
+
+		private:
+			struct Request
+			{
+				std::vector<float> input;
+				std::promise<std::vector<float>> result;
+				Clock::time_point submitted;
+			};
+
+			const InferenceModel model;
+			const ServerConfig config;
+			std::vector<std::thread> workers;
+
+			std::deque<Request> queue;
+			std::mutex queueMutex;
+			std::condition_variable queueCondition;
+			bool stopping = false;
+
+			// Latency of each completed request in seconds
+			mutable std::mutex statsMutex;
+			std::vector<double> latencies;
+			size_t batchCount = 0;
+			Clock::time_point statsStart;
+			Clock::time_point statsEnd;
+
+			void runWorker();
+			bool collectBatch(std::vector<Request>& batch);
+			void runBatch(std::vector<Request>& batch, std::vector<float>& input, std::vector<float>& output);
+		};
+	}
+}
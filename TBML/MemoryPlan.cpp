@@ -0,0 +1,94 @@
+#include <cstdint>
+#include "stdafx.h"
+#include "MemoryPlan.h"
+
+namespace tbml
+{
+	namespace
+	{
+		size_t alignSize(size_t size)
+		{
+			return (size + MemoryPlan::ALIGNMENT - 1) / MemoryPlan::ALIGNMENT * MemoryPlan::ALIGNMENT;
+		}
+	}
+
+	size_t MemoryPlan::addBuffer(size_t size, size_t firstStep, size_t lastStep)
+	{
+		assert(arenaStart == nullptr && "Buffers cannot be added after allocate");
+		assert(firstStep <= lastStep);
+		buffers.push_back({ size, { { firstStep, lastStep } }, 0 });
+		return buffers.size() - 1;
+	}
+
+	void MemoryPlan::addLifetime(size_t index, size_t firstStep, size_t lastStep)
+	{
+		assert(arenaStart == nullptr && "Buffers cannot be changed after allocate");
+		assert(firstStep <= lastStep);
+		buffers[index].lifetimes.push_back({ firstStep, lastStep });
+	}
+
+	void MemoryPlan::allocate()
+	{
+		// Place largest buffers first, each at the lowest offset clear of live placed buffers
+		std::vector<size_t> order(buffers.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return buffers[a].size > buffers[b].size; });
+
+		std::vector<size_t> placed;
+		arenaSize = 0;
+		for (size_t index : order)
+		{
+			Buffer& buffer = buffers[index];
+
+			// Placed buffers whose lifetime overlaps, in offset order
+			std::vector<size_t> live;
+			for (size_t other : placed)
+			{
+				if (buffer.overlaps(buffers[other])) live.push_back(other);
+			}
+			std::sort(live.begin(), live.end(), [&](size_t a, size_t b) { return buffers[a].offset < buffers[b].offset; });
+
+			// First gap that fits
+			size_t offset = 0;
+			for (size_t other : live)
+			{
+				if (offset + buffer.size <= buffers[other].offset) break;
+				offset = std::max(offset, alignSize(buffers[other].offset + buffers[other].size));
+			}
+
+			buffer.offset = offset;
+			arenaSize = std::max(arenaSize, alignSize(offset + buffer.size));
+			placed.push_back(index);
+		}
+
+		// Over allocate so the start can be aligned
+		arena.assign(arenaSize + ALIGNMENT, 0.0f);
+		size_t misalignment = (reinterpret_cast<uintptr_t>(arena.data()) / sizeof(float)) % ALIGNMENT;
+		arenaStart = arena.data() + (misalignment == 0 ? 0 : ALIGNMENT - misalignment);
+	}
+
+	float* MemoryPlan::getBuffer(size_t index)
+	{
+		assert(arenaStart != nullptr && "Arena not allocated");
+		return arenaStart + buffers[index].offset;
+	}
+
+	bool MemoryPlan::Buffer::overlaps(const Buffer& other) const
+	{
+		for (const auto& a : lifetimes)
+		{
+			for (const auto& b : other.lifetimes)
+			{
+				if (a.first <= b.second && b.first <= a.second) return true;
+			}
+		}
+		return false;
+	}
+
+	size_t MemoryPlan::getUnplannedSize() const
+	{
+		size_t total = 0;
+		for (const Buffer& buffer : buffers) total += buffer.size;
+		return total;
+	}
+}
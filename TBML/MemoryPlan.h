@@ -0,0 +1,48 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+namespace tbml
+{
+	// Assigns buffers with known lifetimes to offsets in a single aligned arena
+	// Buffers whose lifetimes do not overlap share memory, steps are any caller defined schedule
+	class MemoryPlan
+	{
+	public:
+		// Offsets are aligned to 16 floats = 64 bytes
+		static const size_t ALIGNMENT = 16;
+
+		// Add a buffer of size floats live for steps [firstStep, lastStep], returns its index
+		size_t addBuffer(size_t size, size_t firstStep, size_t lastStep);
+
+		// Also keep buffer index live for steps [firstStep, lastStep], e.g. while its value is recomputed and used again
+		void addLifetime(size_t index, size_t firstStep, size_t lastStep);
+
+		// Assign offsets then allocate the arena, no buffers can be added after
+		void allocate();
+
+		float* getBuffer(size_t index);
+		size_t getBufferSize(size_t index) const { return buffers[index].size; }
+		size_t getBufferCount() const { return buffers.size(); }
+
+		// Floats in the arena vs. giving every buffer its own memory
+		size_t getArenaSize() const { return arenaSize; }
+		size_t getUnplannedSize() const;
+
+	private:
+		struct Buffer
+		{
+			size_t size;
+			std::vector<std::pair<size_t, size_t>> lifetimes;
+			size_t offset;
+
+			bool overlaps(const Buffer& other) const;
+		};
+
+		std::vector<Buffer> buffers;
+		std::vector<float> arena;
+		float* arenaStart = nullptr;
+		size_t arenaSize = 0;
+	};
+}
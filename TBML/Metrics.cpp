@@ -0,0 +1,128 @@
+#include "stdafx.h"
+#include "Metrics.h"
+#include "omp.h"
+
+namespace tbml
+{
+	namespace fn
+	{
+		namespace
+		{
+			// Below this many output elements threading costs more than it saves
+			const size_t PARALLEL_THRESHOLD = 1 << 16;
+
+			// Rows whose running maximum and rank are kept while walking the columns
+			const size_t ROW_BLOCK = 256;
+		}
+
+		void ClassificationMetrics::add(const ClassificationMetrics& other)
+		{
+			assert(classes == other.classes && k == other.k);
+			rows += other.rows;
+			correct += other.correct;
+			topKCorrect += other.topKCorrect;
+			for (size_t i = 0; i < confusion.size(); i++) confusion[i] += other.confusion[i];
+		}
+
+		float ClassificationMetrics::getPrecision(size_t predicted) const
+		{
+			// Of rows predicted as this class, the fraction that were
+			size_t total = 0;
+			for (size_t expected = 0; expected < classes; expected++) total += getConfusion(expected, predicted);
+			return total > 0 ? (float)getConfusion(predicted, predicted) / total : 0.0f;
+		}
+
+		float ClassificationMetrics::getRecall(size_t expected) const
+		{
+			// Of rows of this class, the fraction predicted as it
+			size_t total = 0;
+			for (size_t predicted = 0; predicted < classes; predicted++) total += getConfusion(expected, predicted);
+			return total > 0 ? (float)getConfusion(expected, expected) / total : 0.0f;
+		}
+
+		void ClassificationMetrics::print() const
+		{
+			printf("Rows: %zd, Accuracy: %.2f%%, Top-%zd Accuracy: %.2f%%\n", rows, getAccuracy() * 100, k, getTopKAccuracy() * 100);
+
+			// Expected class down, predicted class across
+			printf("%8s", "");
+			for (size_t predicted = 0; predicted < classes; predicted++) printf(" %7zd", predicted);
+			printf(" %9s %9s\n", "Recall", "Precision");
+			for (size_t expected = 0; expected < classes; expected++)
+			{
+				printf("%8zd", expected);
+				for (size_t predicted = 0; predicted < classes; predicted++) printf(" %7zd", getConfusion(expected, predicted));
+				printf(" %8.2f%% %8.2f%%\n", getRecall(expected) * 100, getPrecision(expected) * 100);
+			}
+			printf("\n");
+		}
+
+		ClassificationMetrics classificationMetrics(const Tensor& output, const Tensor& expected, size_t k)
+		{
+			assert(output.getShape() == expected.getShape());
+			assert(output.getDims() == 2);
+			size_t rows = output.getShape(0);
+			size_t classes = output.getShape(1);
+			ClassificationMetrics metrics(classes, k);
+			metrics.rows = rows;
+			if (rows == 0) return metrics;
+
+			// Expected classes first, so the single pass over output can rank each row's expected score as it goes
+			std::vector<uint32_t> labels;
+			expected.argmaxRows(labels);
+			const float* values = output.getData().data();
+			int blockCount = (int)((rows + ROW_BLOCK - 1) / ROW_BLOCK);
+
+			#pragma omp parallel if (rows * classes > PARALLEL_THRESHOLD)
+			{
+				// Each thread counts into its own confusion matrix, merged once at the end
+				ClassificationMetrics local(classes, k);
+				float maxValues[ROW_BLOCK];
+				float targets[ROW_BLOCK];
+				uint32_t predicted[ROW_BLOCK];
+				uint32_t ranks[ROW_BLOCK];
+
+				#pragma omp for
+				for (int block = 0; block < blockCount; block++)
+				{
+					size_t row0 = (size_t)block * ROW_BLOCK;
+					size_t blockRows = std::min(ROW_BLOCK, rows - row0);
+					const uint32_t* blockLabels = labels.data() + row0;
+					for (size_t r = 0; r < blockRows; r++)
+					{
+						targets[r] = values[row0 + r + rows * blockLabels[r]];
+						maxValues[r] = values[row0 + r];
+						predicted[r] = 0;
+						ranks[r] = values[row0 + r] > targets[r] ? 1 : 0;
+					}
+
+					// Running argmax and the count of classes beating the expected one across contiguous rows
+					// Branch free as in backend argmaxRows so it vectorizes
+					for (size_t col = 1; col < classes; col++)
+					{
+						const float* column = values + rows * col + row0;
+						for (size_t r = 0; r < blockRows; r++)
+						{
+							uint32_t mask = 0u - (uint32_t)(column[r] > maxValues[r]);
+							maxValues[r] = column[r] > maxValues[r] ? column[r] : maxValues[r];
+							predicted[r] = (predicted[r] & ~mask) | ((uint32_t)col & mask);
+							ranks[r] += (uint32_t)(column[r] > targets[r]);
+						}
+					}
+
+					for (size_t r = 0; r < blockRows; r++)
+					{
+						local.confusion[blockLabels[r] * classes + predicted[r]]++;
+						local.topKCorrect += ranks[r] < k ? 1 : 0;
+					}
+				}
+
+				#pragma omp critical
+				metrics.add(local);
+			}
+
+			for (size_t c = 0; c < classes; c++) metrics.correct += metrics.getConfusion(c, c);
+			return metrics;
+		}
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include "Tensor.h"
+
+namespace tbml
+{
+	namespace fn
+	{
+		// Classification results of output rows against expected rows, the class of a row being its argmax
+		// Counts rather than ratios so results of separate chunks can be added together
+		struct ClassificationMetrics
+		{
+			size_t rows = 0;
+			size_t classes = 0;
+			size_t k = 1;
+			size_t correct = 0;
+			size_t topKCorrect = 0;
+
+			// confusion[expected * classes + predicted] rows with that expected and predicted class
+			std::vector<size_t> confusion;
+
+			ClassificationMetrics() = default;
+			ClassificationMetrics(size_t classes, size_t k) : classes(classes), k(k), confusion(classes * classes, 0) {}
+
+			void add(const ClassificationMetrics& other);
+			float getAccuracy() const { return rows > 0 ? (float)correct / rows : 0.0f; }
+			float getTopKAccuracy() const { return rows > 0 ? (float)topKCorrect / rows : 0.0f; }
+			size_t getConfusion(size_t expected, size_t predicted) const { return confusion[expected * classes + predicted]; }
+			float getPrecision(size_t predicted) const;
+			float getRecall(size_t expected) const;
+			void print() const;
+		};
+
+		// Accuracy, top-k accuracy and confusion matrix in one pass over output, on all cores for large outputs
+		// A row is in the top k if fewer than k classes score strictly higher than its expected class
+		ClassificationMetrics classificationMetrics(const Tensor& output, const Tensor& expected, size_t k = 5);
+	}
+}
@@ -0,0 +1,537 @@
+#include "stdafx.h"
+#include "ModelGraph.h"
+#include "Utility.h"
+#include "Trace.h"
+#include "omp.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		ModelGraph::ModelGraph(int threadCount) : threadCount(threadCount)
+		{
+			Node input;
+			input.type = Node::Type::Input;
+			nodes.push_back(std::move(input));
+		}
+
+		size_t ModelGraph::addLayer(Layer::BasePtr layer, size_t input)
+		{
+			// A layer holds the output and gradients of one use, so it cannot be shared between nodes
+			if (layer == nullptr) throw std::runtime_error("Layer cannot be null");
+			for (const Node& node : nodes)
+			{
+				if (node.layer == layer) throw std::runtime_error("Layer is already in the graph");
+			}
+
+			Node node;
+			node.type = Node::Type::Layer;
+			node.layer = std::move(layer);
+			node.inputs = { input };
+			return addNode(std::move(node));
+		}
+
+		size_t ModelGraph::addConcat(const std::vector<size_t>& inputs)
+		{
+			Node node;
+			node.type = Node::Type::Concat;
+			node.inputs = inputs;
+			node.gradInputs.resize(inputs.size());
+			return addNode(std::move(node));
+		}
+
+		size_t ModelGraph::addAdd(const std::vector<size_t>& inputs)
+		{
+			Node node;
+			node.type = Node::Type::Add;
+			node.inputs = inputs;
+			return addNode(std::move(node));
+		}
+
+		size_t ModelGraph::addNode(Node&& node)
+		{
+			// Only existing nodes can be consumed, which keeps ids in topological order and the graph acyclic
+			size_t id = nodes.size();
+			if (node.inputs.empty()) throw std::runtime_error("Node needs at least one input");
+			for (size_t input : node.inputs)
+			{
+				if (input >= id) throw std::runtime_error("Node input does not exist");
+			}
+
+			for (size_t input : node.inputs) nodes[input].consumers.push_back(id);
+			nodes.push_back(std::move(node));
+			outputNode = id;
+			return id;
+		}
+
+		void ModelGraph::setOutput(size_t node)
+		{
+			if (node >= nodes.size()) throw std::runtime_error("Output node does not exist");
+			outputNode = node;
+		}
+
+		void ModelGraph::setThreadCount(int threadCount)
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			this->threadCount = threadCount;
+			pool.reset();
+		}
+
+		size_t ModelGraph::getThreadCount() const
+		{
+			return threadCount == -1 ? (size_t)omp_get_num_procs() : (size_t)std::max(threadCount, 1);
+		}
+
+		ThreadPool* ModelGraph::getPool() const
+		{
+			// Created on first use, the calling thread also runs nodes so the pool has one thread fewer
+			size_t threads = getThreadCount();
+			if (threads <= 1) return nullptr;
+			std::lock_guard<std::mutex> lock(poolMutex);
+			if (pool == nullptr) pool = std::make_unique<ThreadPool>(threads - 1);
+			return pool.get();
+		}
+
+		bool ModelGraph::isChain() const
+		{
+			// With no fan in or fan out there is never more than one node ready
+			for (const Node& node : nodes)
+			{
+				if (node.inputs.size() > 1 || node.consumers.size() > 1) return false;
+			}
+			return true;
+		}
+
+		Tensor ModelGraph::propogate(const Tensor& input) const
+		{
+			// Values live in this call only so concurrent calls are safe, as with NeuralNetwork::propogate
+			// Each value is released by its last reader, so a layer given a value nothing else reads propogates it in place
+			trace::Scope scope("ModelGraph propogate");
+			std::vector<Tensor> values(nodes.size());
+			std::unique_ptr<std::atomic<size_t>[]> readers(new std::atomic<size_t>[nodes.size()]);
+			for (size_t i = 0; i < nodes.size(); i++) readers[i] = nodes[i].consumers.size() + (i == outputNode ? 1 : 0);
+			values[INPUT] = input;
+			auto release = [&](size_t i) { if (--readers[i] == 0) values[i] = Tensor(); };
+
+			runNodes([&](size_t i)
+			{
+				const Node& node = nodes[i];
+				Layer::Dense* dense;
+				Layer::Activation* activation;
+				switch (node.type)
+				{
+				case Node::Type::Input:
+					break;
+
+				case Node::Type::Layer:
+					if (isFusedDense(i)) break;
+					if (getFusedPair(i, dense, activation))
+					{
+						size_t source = nodes[node.inputs[0]].inputs[0];
+						values[i] = values[source];
+						release(source);
+						dense->propogateMut(values[i], activation->getFunction());
+					}
+					else
+					{
+						values[i] = values[node.inputs[0]];
+						release(node.inputs[0]);
+						node.layer->propogateMut(values[i]);
+					}
+					break;
+
+				case Node::Type::Concat:
+				{
+					std::vector<const Tensor*> inputs;
+					for (size_t input : node.inputs) inputs.push_back(&values[input]);
+					values[i].concatColumns(inputs);
+					for (size_t input : node.inputs) release(input);
+					break;
+				}
+
+				case Node::Type::Add:
+					values[i].axpby(1.0f, values[node.inputs[0]], 0.0f);
+					for (size_t k = 1; k < node.inputs.size(); k++)
+					{
+						assert(values[node.inputs[k]].getShape() == values[i].getShape());
+						values[i].axpby(1.0f, values[node.inputs[k]], 1.0f);
+					}
+					for (size_t input : node.inputs) release(input);
+					break;
+				}
+			}, false);
+			return values[outputNode];
+		}
+
+		const Tensor* ModelGraph::propogatePtr(const Tensor* input)
+		{
+			// Outputs are kept in each node for backpropogation
+			currentInput = input;
+			runNodes([this](size_t i) { propogateNode(i); }, false);
+			return getOutputPtr(outputNode);
+		}
+
+		void ModelGraph::runNodes(const std::function<void(size_t)>& run, bool isBackward) const
+		{
+			// Chains and single threads run in topological order, or its reverse, with no scheduling overhead
+			ThreadPool* threadPool = isChain() ? nullptr : getPool();
+			if (threadPool == nullptr)
+			{
+				if (isBackward) for (size_t i = nodes.size(); i-- > 0;) run(i);
+				else for (size_t i = 0; i < nodes.size(); i++) run(i);
+				return;
+			}
+
+			// A node is ready once its dependencies finish, its inputs going forward and its consumers going backward
+			std::shared_ptr<Schedule> schedule = std::make_shared<Schedule>();
+			schedule->run = run;
+			schedule->pool = threadPool;
+			schedule->isBackward = isBackward;
+			schedule->pending.reset(new std::atomic<size_t>[nodes.size()]);
+			std::vector<size_t> roots;
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				schedule->pending[i] = isBackward ? nodes[i].consumers.size() : nodes[i].inputs.size();
+				if (schedule->pending[i] == 0) roots.push_back(i);
+			}
+
+			// This thread takes the first root and then waits for every node, the first error is rethrown
+			for (size_t k = 1; k < roots.size(); k++)
+			{
+				size_t root = roots[k];
+				threadPool->enqueue([this, schedule, root] { runFrom(schedule, root); });
+			}
+			runFrom(schedule, roots[0]);
+			std::unique_lock<std::mutex> lock(schedule->mutex);
+			schedule->condition.wait(lock, [&] { return schedule->finished == nodes.size(); });
+			if (schedule->error != nullptr) std::rethrow_exception(schedule->error);
+		}
+
+		void ModelGraph::runFrom(std::shared_ptr<Schedule> schedule, size_t node) const
+		{
+			// Run the node then release what depends on it, continuing with one newly ready node on this thread
+			// A chain within the graph stays on one thread and only extra branches are handed to the pool
+			// After an error nodes are still released but not run, so the caller is always woken
+			while (true)
+			{
+				if (!schedule->failed)
+				{
+					try { schedule->run(node); }
+					catch (...)
+					{
+						std::lock_guard<std::mutex> lock(schedule->mutex);
+						if (!schedule->failed.exchange(true)) schedule->error = std::current_exception();
+					}
+				}
+
+				size_t next = nodes.size();
+				const std::vector<size_t>& successors = schedule->isBackward ? nodes[node].inputs : nodes[node].consumers;
+				for (size_t successor : successors)
+				{
+					if (--schedule->pending[successor] != 0) continue;
+					if (next == nodes.size()) next = successor;
+					else schedule->pool->enqueue([this, schedule, successor] { runFrom(schedule, successor); });
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(schedule->mutex);
+					if (++schedule->finished == nodes.size()) schedule->condition.notify_all();
+				}
+				if (next == nodes.size()) return;
+				node = next;
+			}
+		}
+
+		const Tensor* ModelGraph::getOutputPtr(size_t node) const
+		{
+			switch (nodes[node].type)
+			{
+			case Node::Type::Input: return currentInput;
+			case Node::Type::Layer: return nodes[node].layer->getOutputPtr();
+			default: return &nodes[node].output;
+			}
+		}
+
+		void ModelGraph::propogateNode(size_t i)
+		{
+			trace::Scope scope("forward", "node", i);
+			Node& node = nodes[i];
+			Layer::Dense* dense;
+			Layer::Activation* activation;
+			switch (node.type)
+			{
+			case Node::Type::Input:
+				break;
+
+			case Node::Type::Layer:
+				// A fused Dense runs when its activation's node does
+				if (isFusedDense(i)) break;
+				if (getFusedPair(i, dense, activation)) activation->propogateFused(getOutputPtr(nodes[node.inputs[0]].inputs[0]), *dense);
+				else node.layer->propogatePtr(getOutputPtr(node.inputs[0]));
+				break;
+
+			case Node::Type::Concat:
+			{
+				std::vector<const Tensor*> inputs;
+				for (size_t input : node.inputs) inputs.push_back(getOutputPtr(input));
+				node.output.concatColumns(inputs);
+				break;
+			}
+
+			case Node::Type::Add:
+				node.output.axpby(1.0f, *getOutputPtr(node.inputs[0]), 0.0f);
+				for (size_t k = 1; k < node.inputs.size(); k++)
+				{
+					assert(getOutputPtr(node.inputs[k])->getShape() == node.output.getShape());
+					node.output.axpby(1.0f, *getOutputPtr(node.inputs[k]), 1.0f);
+				}
+				break;
+			}
+		}
+
+		void ModelGraph::backpropogateNode(size_t i)
+		{
+			trace::Scope scope("backward", "node", i);
+			Node& node = nodes[i];
+			if (node.type == Node::Type::Input) return;
+
+			// Sum what each reached consumer passes back for every edge from this node
+			// Consumers are added in order so repeated edges to one consumer are adjacent
+			node.grad = i == outputNode && !fuseSoftmaxLoss ? &gradLoss : nullptr;
+			for (size_t k = 0; k < node.consumers.size(); k++)
+			{
+				const Node& consumer = nodes[node.consumers[k]];
+				if (!consumer.isReached || (k > 0 && node.consumers[k] == node.consumers[k - 1])) continue;
+				for (size_t p = 0; p < consumer.inputs.size(); p++)
+				{
+					if (consumer.inputs[p] != i) continue;
+					const Tensor* grad;
+					switch (consumer.type)
+					{
+					case Node::Type::Layer: grad = consumer.layer->getGradInputPtr(); break;
+					case Node::Type::Concat: grad = &consumer.gradInputs[p]; break;
+					default: grad = consumer.grad; break;
+					}
+
+					if (node.grad == nullptr) node.grad = grad;
+					else
+					{
+						if (node.grad != &node.gradSum) node.gradSum.axpby(1.0f, *node.grad, 0.0f);
+						node.gradSum.axpby(1.0f, *grad, 1.0f);
+						node.grad = &node.gradSum;
+					}
+				}
+			}
+
+			// A Softmax fused into the loss has already backpropogated
+			node.isReached = node.grad != nullptr || (i == outputNode && fuseSoftmaxLoss);
+			if (!node.isReached) return;
+			switch (node.type)
+			{
+			case Node::Type::Layer:
+				if (node.grad != nullptr) node.layer->backpropogate(node.grad);
+				break;
+
+			case Node::Type::Concat:
+			{
+				// Each input's gradient is its block of columns
+				size_t first = 0;
+				for (size_t p = 0; p < node.inputs.size(); p++)
+				{
+					size_t count = getOutputPtr(node.inputs[p])->getShape(1);
+					node.gradInputs[p].sliceColumns(*node.grad, first, count);
+					first += count;
+				}
+				break;
+			}
+
+			default:
+				// Add passes its gradient to every input unchanged
+				break;
+			}
+		}
+
+		float ModelGraph::backpropogateLoss(const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn)
+		{
+			// Loss of the output, its gradient is picked up by the output node in backpropogateNode
+			trace::Scope scope("loss");
+			const Node& output = nodes[outputNode];
+			if (fuseSoftmaxLoss) return static_cast<Layer::Softmax&>(*output.layer).backpropogateCrossEntropy(expected);
+
+			return lossFn->calculateWithGradient(*getOutputPtr(outputNode), expected, gradLoss);
+		}
+
+		bool ModelGraph::getFusedPair(size_t node, Layer::Dense*& dense, Layer::Activation*& activation) const
+		{
+			// An activation node reading a Dense node nothing else reads runs as a single kernel, as in NeuralNetwork
+			if (nodes[node].type != Node::Type::Layer) return false;
+			activation = dynamic_cast<Layer::Activation*>(nodes[node].layer.get());
+			if (activation == nullptr) return false;
+
+			size_t input = nodes[node].inputs[0];
+			if (nodes[input].type != Node::Type::Layer || nodes[input].consumers.size() != 1 || input == outputNode) return false;
+			dense = dynamic_cast<Layer::Dense*>(nodes[input].layer.get());
+			return dense != nullptr;
+		}
+
+		bool ModelGraph::isFusedDense(size_t node) const
+		{
+			Layer::Dense* dense;
+			Layer::Activation* activation;
+			return nodes[node].consumers.size() == 1 && getFusedPair(nodes[node].consumers[0], dense, activation);
+		}
+
+		void ModelGraph::train(const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr lossFn, const TrainingConfig& config)
+		{
+			// Parallelism comes from running independent nodes together, set with setThreadCount
+			if (config.threadCount != 1 || config.asynchronous || config.pipelineStages > 1 || !config.checkpointLayers.empty() || config.checkpointInterval != 0 || config.profiler != nullptr)
+			{
+				throw std::runtime_error("ModelGraph does not support replica, pipeline, checkpoint or profiler training options");
+			}
+
+			// Setup data batchers
+			trace::Scope trainScope("train");
+			TensorBatcher batcher(input, expected, config.batchSize, false, false);
+			size_t maxBatch = batcher.getBatchCount();
+
+			// Softmax into cross entropy backpropogates in one fused pass
+			const Node& output = nodes[outputNode];
+			fuseSoftmaxLoss = output.type == Node::Type::Layer && dynamic_cast<Layer::Softmax*>(output.layer.get()) != nullptr
+				&& dynamic_cast<const fn::CrossEntropy*>(lossFn.get()) != nullptr;
+
+			OptimizerPtr optimizer = (config.optimizer != nullptr ? config.optimizer : std::make_shared<SGD>(config.learningRate, config.momentumRate))->clone();
+			std::vector<Parameter> parameters = getParameters();
+
+			// Train for each batch for each epoch
+			size_t maxEpoch = config.maxEpoch == -1 ? NeuralNetwork::MAX_EPOCHS : config.maxEpoch;
+			if (config.logLevel > 0) printf("Training started for %zd epochs with %s\n", maxEpoch, optimizer->getName().c_str());
+			std::chrono::steady_clock::time_point tTrainStart = std::chrono::steady_clock::now();
+			std::chrono::steady_clock::time_point tEpochStart = tTrainStart;
+			std::chrono::steady_clock::time_point tBatchStart = tTrainStart;
+
+			size_t epoch = 0;
+			size_t sampleCount = 0;
+			for (; epoch < maxEpoch; epoch++)
+			{
+				trace::Scope epochScope("epoch", "epoch", epoch);
+				{
+					trace::Scope loadScope("TensorBatcher");
+					batcher.shuffleAndLoad();
+				}
+
+				float epochLoss = 0.0f;
+				for (size_t batch = 0; batch < maxBatch; batch++)
+				{
+					trace::Scope batchScope("batch", "batch", batch);
+
+					// Forward then backward through the graph, each running ready nodes together
+					const Tensor& inputBatch = batcher.getBatchInput(batch);
+					const Tensor& expectedBatch = batcher.getBatchExpected(batch);
+					propogatePtr(&inputBatch);
+					float batchLoss = backpropogateLoss(expectedBatch, lossFn);
+					runNodes([this](size_t i) { backpropogateNode(i); }, true);
+					epochLoss += batchLoss / maxBatch;
+					sampleCount += inputBatch.getShape(0);
+
+					// Update parameters from the batch gradient
+					{
+						trace::Scope scope("optimizer");
+						optimizer->step(parameters);
+						for (auto& node : nodes)
+						{
+							if (node.layer != nullptr) node.layer->onParametersUpdated();
+						}
+					}
+
+					if (config.logLevel >= 3)
+					{
+						if ((batch + 1) % config.logFrequency == 0)
+						{
+							std::chrono::steady_clock::time_point tBatchEnd = std::chrono::steady_clock::now();
+							auto us = std::chrono::duration_cast<std::chrono::microseconds>(tBatchEnd - tBatchStart);
+							printf("Epoch [%zd / %zd], Batch [%zd / %zd]: Loss: %.3f, Time: %.3fms\n", epoch + 1, maxEpoch, batch + 1, maxBatch, batchLoss, us.count() / 1000.0f);
+							tBatchStart = tBatchEnd;
+						}
+					}
+				}
+
+				if (config.logLevel >= 2)
+				{
+					std::chrono::steady_clock::time_point tEpochEnd = std::chrono::steady_clock::now();
+					auto us = std::chrono::duration_cast<std::chrono::microseconds>(tEpochEnd - tEpochStart);
+					printf("Epoch [%zd / %zd]: Average Loss: %.3f, Total Time: %.3fms\n", epoch + 1, maxEpoch, epochLoss, us.count() / 1000.0f);
+					tEpochStart = tEpochEnd;
+					tBatchStart = tEpochEnd;
+				}
+
+				// Exit if error threshold is met or the callback stops training
+				if (epochLoss < config.errorThreshold) break;
+				if (config.epochCallback != nullptr && !config.epochCallback(epoch, epochLoss)) break;
+			}
+
+			if (config.logLevel >= 1)
+			{
+				std::chrono::steady_clock::time_point tTrainEnd = std::chrono::steady_clock::now();
+				auto us = std::chrono::duration_cast<std::chrono::microseconds>(tTrainEnd - tTrainStart);
+				printf("Training complete for %zd epochs, Time taken: %.3fms\n", epoch, us.count() / 1000.0f);
+				float samplesPerSecond = sampleCount / (us.count() / 1'000'000.0f);
+				printf("Throughput: %.1f samples/s, %zd threads, %s\n\n", samplesPerSecond, isChain() ? (size_t)1 : getThreadCount(), isChain() ? "chain" : "graph");
+			}
+
+			currentInput = nullptr;
+		}
+
+		std::unique_ptr<ModelGraph> ModelGraph::clone() const
+		{
+			// Same edges with cloned layers
+			std::unique_ptr<ModelGraph> graph = std::make_unique<ModelGraph>(threadCount);
+			for (size_t i = 1; i < nodes.size(); i++)
+			{
+				Node node;
+				node.type = nodes[i].type;
+				node.layer = nodes[i].layer != nullptr ? nodes[i].layer->clone() : nullptr;
+				node.inputs = nodes[i].inputs;
+				node.gradInputs.resize(nodes[i].gradInputs.size());
+				graph->addNode(std::move(node));
+			}
+			graph->setOutput(outputNode);
+			return graph;
+		}
+
+		void ModelGraph::print() const
+		{
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				const Node& node = nodes[i];
+				std::string name = node.type == Node::Type::Input ? "Input" : node.type == Node::Type::Concat ? "Concat" : node.type == Node::Type::Add ? "Add" : node.layer->getName();
+				printf("Node %zd: %s", i, name.c_str());
+				for (size_t k = 0; k < node.inputs.size(); k++) printf(k == 0 ? " <- %zd" : ", %zd", node.inputs[k]);
+				printf(i == outputNode ? " (output)\n" : "\n");
+				if (node.layer != nullptr) node.layer->print();
+			}
+		}
+
+		size_t ModelGraph::getParameterCount() const
+		{
+			size_t count = 0;
+			for (const auto& node : nodes)
+			{
+				if (node.layer != nullptr) count += node.layer->getParameterCount();
+			}
+			return count;
+		}
+
+		std::vector<Parameter> ModelGraph::getParameters()
+		{
+			std::vector<Parameter> parameters;
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				if (nodes[i].layer == nullptr) continue;
+				size_t first = parameters.size();
+				nodes[i].layer->getParameters(parameters);
+				for (size_t j = first; j < parameters.size(); j++) parameters[j].layer = i;
+			}
+			return parameters;
+		}
+	}
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include "NeuralNetwork.h"
+#include "ThreadPool.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		// Layers wired by explicit tensor edges rather than a single chain, node 0 is the graph input
+		// Nodes only consume earlier nodes so their ids are a topological order
+		// Nodes whose inputs are ready run concurrently on a thread pool, backprop runs in reverse
+		class ModelGraph
+		{
+		public:
+			static const size_t INPUT = 0;
+
+			// threadCount threads run ready nodes, -1 for one per core, 1 runs every node in order on the caller
+			ModelGraph(int threadCount = -1);
+			ModelGraph(const ModelGraph&) = delete;
+			ModelGraph& operator=(const ModelGraph&) = delete;
+
+			// Each returns the new node, whose output becomes the graph output until setOutput
+			// A layer can appear in only one node, concat joins 2D inputs along dim 1, add sums inputs of one shape
+			size_t addLayer(Layer::BasePtr layer, size_t input);
+			size_t addConcat(const std::vector<size_t>& inputs);
+			size_t addAdd(const std::vector<size_t>& inputs);
+			void setOutput(size_t node);
+
+			Tensor propogate(const Tensor& input) const;
+			const Tensor* propogatePtr(const Tensor* input);
+			void train(const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr lossFn, const TrainingConfig& config);
+
+			void setThreadCount(int threadCount);
+			size_t getThreadCount() const;
+			std::unique_ptr<ModelGraph> clone() const;
+			void print() const;
+			size_t getNodeCount() const { return nodes.size(); }
+			size_t getOutput() const { return outputNode; }
+			bool isChain() const;
+			size_t getParameterCount() const;
+			std::vector<Parameter> getParameters();
+
+		private:
+			struct Node
+			{
+				enum class Type { Input, Layer, Concat, Add };
+
+				Type type;
+				Layer::BasePtr layer;
+				std::vector<size_t> inputs;
+				std::vector<size_t> consumers;
+
+				// Merge output, and the gradient it passes to each input for a concat
+				Tensor output;
+				std::vector<Tensor> gradInputs;
+
+				// Gradient of the loss to this node's output, gradSum holds it when several consumers contribute
+				// Nodes not feeding the graph output are not reached and have no gradient
+				const Tensor* grad = nullptr;
+				Tensor gradSum;
+				bool isReached = false;
+			};
+
+			// Nodes left to finish in one scheduled pass and how many dependencies each still waits on
+			struct Schedule
+			{
+				std::function<void(size_t)> run;
+				ThreadPool* pool;
+				bool isBackward;
+				std::unique_ptr<std::atomic<size_t>[]> pending;
+				std::atomic<bool> failed{ false };
+				std::exception_ptr error;
+				size_t finished = 0;
+				std::mutex mutex;
+				std::condition_variable condition;
+			};
+
+			std::vector<Node> nodes;
+			size_t outputNode = INPUT;
+			int threadCount;
+			mutable std::unique_ptr<ThreadPool> pool;
+			mutable std::mutex poolMutex;
+
+			// Training state, the batch input and the loss gradient to the output if not fused
+			const Tensor* currentInput = nullptr;
+			Tensor gradLoss;
+			bool fuseSoftmaxLoss = false;
+
+			size_t addNode(Node&& node);
+			void runNodes(const std::function<void(size_t)>& run, bool isBackward) const;
+			void runFrom(std::shared_ptr<Schedule> schedule, size_t node) const;
+			ThreadPool* getPool() const;
+			const Tensor* getOutputPtr(size_t node) const;
+			void propogateNode(size_t node);
+			void backpropogateNode(size_t node);
+			float backpropogateLoss(const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn);
+			bool getFusedPair(size_t node, Layer::Dense*& dense, Layer::Activation*& activation) const;
+			bool isFusedDense(size_t node) const;
+		};
+	}
+}
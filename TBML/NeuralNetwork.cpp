@@ -1,12 +1,19 @@
 ﻿#include "stdafx.h"
 #include "NeuralNetwork.h"
 #include "Utility.h"
+#include "Trace.h"
 #include "omp.h"
 
 namespace tbml
 {
 	namespace nn
 	{
+		namespace
+		{
+			// Micro-batches a pipeline stage can run ahead of the next
+			const size_t PIPELINE_QUEUE_CAPACITY = 2;
+		}
+
 		namespace Layer
 		{
 			BasePtr deserialize(std::istream& is)
@@ -20,6 +27,14 @@ namespace tbml
 					Tensor bias = Tensor::deserialize(is);
 					return std::make_shared<Dense>(std::move(weights), std::move(bias));
 				}
+				else if (type == "Conv2D")
+				{
+					backend::ConvShape conv;
+					is >> conv.channels >> conv.height >> conv.width >> conv.kernel >> conv.stride >> conv.padding;
+					Tensor weights = Tensor::deserialize(is);
+					Tensor bias = Tensor::deserialize(is);
+					return std::make_shared<Conv2D>(conv, std::move(weights), std::move(bias));
+				}
 				else if (type == "ReLU")
 				{
 					return std::make_shared<ReLU>();
@@ -45,8 +60,10 @@ namespace tbml
 		{
 			Dense::Dense(const Dense& other)
 			{
+				// Weights, bias and mask are shared copy-on-write with other
 				weights = other.weights;
 				bias = other.bias;
+				mask = other.mask;
 			}
 
 			Dense::Dense(size_t inputSize, size_t outputSize, InitType initType, bool useBias)
@@ -74,63 +91,209 @@ namespace tbml
 			{}
 
 			void Dense::propogateMut(Tensor& input) const
+			{
+				propogateMut(input, backend::Activation::Identity);
+			}
+
+			const Tensor* Dense::propogatePtr(const Tensor* input)
+			{
+				propogateInto(input, backend::Activation::Identity, output);
+				return &output;
+			}
+
+			void Dense::propogateMut(Tensor& input, backend::Activation fn) const
 			{
 				assert(input.getDims() == 2 && input.getShape(1) == weights.getShape(0) && "Input shape does not match weights shape");
 
-				// Mutably propogate input with weights and bias
-				input.matmul(weights).add(bias, 0);
+				// Mutably propogate input with weights, bias and fn in one kernel
+				// Sparse enough weights use the sparse matmul, otherwise single rows use the fused gemv and batches the packed matmul
+				// Backends preferring unpacked weights take them as they are for batches
+				const SparseMatrix* sparse = getSparseWeights();
+				if (sparse != nullptr && sparse->isFasterFor(input.getShape(0))) input.matmul(*sparse, bias, fn);
+				else if (input.getShape(0) == 1) input.gemv(weights, bias, fn);
+				else if (backend::get().prefersUnpackedWeights()) input.matmul(weights, bias, fn);
+				else input.matmul(getPackedWeights(), bias, fn);
 			}
 
-			const Tensor* Dense::propogatePtr(const Tensor* input)
+			void Dense::propogateInto(const Tensor* input, backend::Activation fn, Tensor& destination)
 			{
 				assert(input->getDims() == 2 && input->getShape(1) == weights.getShape(0) && "Input shape does not match weights shape");
 
-				// Propogate input with weights and bias
-				// Retain input and output for backprop
+				// Propogate input with weights, bias and fn in one kernel, writing into destination's storage
+				// Retain input for backprop
 				this->input = input;
-				output = input->matmulled(weights).add(bias, 0);
-				return &output;
+				const SparseMatrix* sparse = getSparseWeights();
+				if (sparse != nullptr && sparse->isFasterFor(input->getShape(0))) destination.gemmBiasActivate(*input, *sparse, bias, fn);
+				else if (input->getShape(0) == 1) destination.gemvBiasActivate(*input, weights, bias, fn);
+				else if (backend::get().prefersUnpackedWeights()) destination.gemmBiasActivate(*input, weights, bias, fn);
+				else destination.gemmBiasActivate(*input, getPackedWeights(), bias, fn);
 			}
 
 			void Dense::backpropogate(const Tensor* gradOutput)
 			{
 				assert(gradOutput->getDims() == 2 && gradOutput->getShape(1) == weights.getShape(1) && "gradOutput shape does not match weights shape");
 
-				// Calculate pd to neuron in and layer in
-				gradInput = gradOutput->matmulled(weights.transposed());
+				// Calculate pd to neuron in and layer in = gradOutput * weights^T
+				gradInput.gemm(1.0f, *gradOutput, weights, 0.0f, false, true);
 
 				// Calculate pd to weights and bias as average of batches
-				int batchSize = (int)input->getShape(0);
-				int m = (int)weights.getShape(0);
-				int n = (int)weights.getShape(1);
-				gradWeights = Tensor(weights.getShape(), 0);
-				gradBias = Tensor(bias.getShape(), 0);
+				// gradWeights = input^T * gradOutput / batch, gradBias = Σ rows of gradOutput / batch
+				// Each element is reduced by a single thread so this is race free and deterministic
+				float batchScale = 1.0f / (float)input->getShape(0);
+				gradWeights.gemm(batchScale, *input, *gradOutput, 0.0f, true, false);
+				if (bias.getSize() > 0) gradBias.sumRows(batchScale, *gradOutput, 0.0f);
+			}
+
+			double Dense::getForwardFlops() const
+			{
+				// input * weights then the bias
+				double rows = (double)input->getShape(0);
+				return 2.0 * rows * weights.getSize() + rows * bias.getSize();
+			}
+
+			double Dense::getBackwardFlops() const
+			{
+				// gradInput and gradWeights products then the bias row sums
+				double rows = (double)input->getShape(0);
+				return 4.0 * rows * weights.getSize() + rows * bias.getSize();
+			}
+
+			void Dense::getParameters(std::vector<Parameter>& parameters)
+			{
+				parameters.push_back({ &weights, &gradWeights });
+				if (bias.getSize() > 0) parameters.push_back({ &bias, &gradBias });
+			}
+
+			void Dense::onParametersUpdated()
+			{
+				// Optimizers move pruned weights through momentum or decay, so zero them again
+				if (mask.getSize() > 0) weights.mult(mask);
+				isPackedValid = false;
+				isSparseValid = false;
+			}
+
+			void Dense::shareParameters(const Base* source)
+			{
+				// Share copy-on-write so replicas cost no copy
+				// Releasing to ZERO leaves source the only owner so it updates in place
+				if (source == nullptr)
+				{
+					weights = Tensor::ZERO;
+					bias = Tensor::ZERO;
+				}
+				else
+				{
+					const Dense& dense = dynamic_cast<const Dense&>(*source);
+					weights = dense.weights;
+					bias = dense.bias;
+				}
+				isPackedValid = false;
+				isSparseValid = false;
+			}
+
+			void Dense::reduceGradients(const Base* other, float otherScale, float scale)
+			{
+				if (other == nullptr)
+				{
+					gradWeights.mult(scale);
+					if (bias.getSize() > 0) gradBias.mult(scale);
+					return;
+				}
+
+				const Dense& dense = dynamic_cast<const Dense&>(*other);
+				gradWeights.axpby(otherScale, dense.gradWeights, scale);
+				if (bias.getSize() > 0) gradBias.axpby(otherScale, dense.gradBias, scale);
+			}
+
+			void Dense::bindParameters(Base* source)
+			{
+				// Views write straight into source's storage, each replica has its own optimizer state
+				if (source == nullptr)
+				{
+					weights.unbindView();
+					bias.unbindView();
+				}
+				else
+				{
+					Dense& dense = dynamic_cast<Dense&>(*source);
+					weights.bindView(dense.weights);
+					if (dense.bias.getSize() > 0) bias.bindView(dense.bias);
+				}
+				isPackedValid = false;
+				isSparseValid = false;
+			}
 
-				#pragma omp parallel for num_threads(12)
-				for (int batchRow = 0; batchRow < batchSize; batchRow++)
+			const PackedMatrix& Dense::getPackedWeights() const
+			{
+				// Pack on first use, locked as const propogation can be shared across threads
+				if (!isPackedValid.load(std::memory_order_acquire))
 				{
-					for (int i = 0; i < m; i++)
+					std::lock_guard<std::mutex> lock(packMutex);
+					if (!isPackedValid.load(std::memory_order_relaxed))
 					{
-						for (int j = 0; j < n; j++)
-						{
-							gradWeights(i, j) += ((*input)(batchRow, i) * gradOutput->at(batchRow, j)) / batchSize;
-						}
+						weights.packPanels(packedWeights);
+						isPackedValid.store(true, std::memory_order_release);
 					}
+				}
+				return packedWeights;
+			}
 
-					for (int j = 0; j < n; j++)
+			const SparseMatrix* Dense::getSparseWeights() const
+			{
+				// Count nonzeros on first use and only compress when the sparse kernel would be chosen, locked as getPackedWeights
+				if (!isSparseValid.load(std::memory_order_acquire))
+				{
+					std::lock_guard<std::mutex> lock(packMutex);
+					if (!isSparseValid.load(std::memory_order_relaxed))
 					{
-						gradBias(0, j) += gradOutput->at(batchRow, j) / batchSize;
+						float density = weights.getSize() > 0 ? (float)weights.getNonZeroCount() / weights.getSize() : 1.0f;
+						if (density <= SparseMatrix::MAX_GEMM_DENSITY) weights.packSparse(sparseWeights);
+						else sparseWeights = SparseMatrix();
+						isSparseValid.store(true, std::memory_order_release);
 					}
 				}
+				return sparseWeights.isEmpty() ? nullptr : &sparseWeights;
 			}
 
-			void Dense::gradientDescent(float learningRate, float momentumRate)
+			void Dense::pruneBelow(float threshold)
 			{
-				// Apply gradient descent with momentum
-				momentumWeights = (momentumWeights * momentumRate) - (gradWeights * learningRate);
-				momentumBias = (momentumBias * momentumRate) - (gradBias * learningRate);
-				weights += momentumWeights;
-				bias += momentumBias;
+				std::vector<float> maskValues = mask.getSize() > 0 ? mask.getData() : std::vector<float>(weights.getSize(), 1.0f);
+				const std::vector<float>& values = weights.getData();
+				for (size_t i = 0; i < values.size(); i++)
+				{
+					if (std::abs(values[i]) < threshold) maskValues[i] = 0.0f;
+				}
+				setMask(std::move(maskValues));
+			}
+
+			void Dense::pruneTopK(size_t k)
+			{
+				// Each column of weights feeds one output, keep its k largest magnitudes
+				std::vector<float> maskValues = mask.getSize() > 0 ? mask.getData() : std::vector<float>(weights.getSize(), 1.0f);
+				const std::vector<float>& values = weights.getData();
+				size_t inputSize = weights.getShape(0);
+				if (k >= inputSize) return;
+				std::vector<size_t> order(inputSize);
+				for (size_t col = 0; col < weights.getShape(1); col++)
+				{
+					const float* column = values.data() + col * inputSize;
+					std::iota(order.begin(), order.end(), 0);
+					std::nth_element(order.begin(), order.begin() + k, order.end(),
+						[column](size_t a, size_t b) { return std::abs(column[a]) > std::abs(column[b]); });
+					for (size_t i = k; i < inputSize; i++) maskValues[order[i] + col * inputSize] = 0.0f;
+				}
+				setMask(std::move(maskValues));
+			}
+
+			float Dense::getSparsity() const
+			{
+				return weights.getSize() > 0 ? 1.0f - (float)weights.getNonZeroCount() / weights.getSize() : 0.0f;
+			}
+
+			void Dense::setMask(std::vector<float>&& maskValues)
+			{
+				mask = Tensor(weights.getShape(), std::move(maskValues));
+				onParametersUpdated();
 			}
 
 			void Dense::print() const
@@ -154,101 +317,281 @@ namespace tbml
 
 		namespace Layer
 		{
-			void ReLU::propogateMut(Tensor& input) const
+			Conv2D::Conv2D(const Conv2D& other)
 			{
-				// Mutably propogate input with ReLU activation
-				input.map([](float x) { return std::max(0.0f, x); });
+				// Weights and bias are shared copy-on-write with other
+				conv = other.conv;
+				weights = other.weights;
+				bias = other.bias;
 			}
 
-			const Tensor* ReLU::propogatePtr(const Tensor* input)
+			Conv2D::Conv2D(const backend::ConvShape& conv, size_t filters, Dense::InitType initType, bool useBias)
+				: conv(conv)
 			{
-				// Propogate input with ReLU activation
-				// Retain input and output for backprop
+				if (conv.kernel == 0 || conv.stride == 0 || conv.kernel > conv.height + 2 * conv.padding || conv.kernel > conv.width + 2 * conv.padding)
+					throw std::runtime_error("Invalid convolution shape");
+
+				weights = Tensor({ conv.getPatchSize(), filters }, 0);
+
+				if (initType == Dense::InitType::RANDOM)
+				{
+					weights.map([](float) { return fn::getRandomFloat() * 2 - 1; });
+				}
+
+				if (useBias)
+				{
+					bias = Tensor({ 1, filters }, 0);
+
+					if (initType == Dense::InitType::RANDOM)
+					{
+						bias.map([](float) { return fn::getRandomFloat() * 2 - 1; });
+					}
+				}
+			}
+
+			Conv2D::Conv2D(const backend::ConvShape& conv, Tensor&& weights, Tensor&& bias)
+				: conv(conv), weights(std::move(weights)), bias(std::move(bias))
+			{
+				if (this->weights.getDims() != 2 || this->weights.getShape(0) != conv.getPatchSize())
+					throw std::runtime_error("Weights shape does not match convolution shape");
+			}
+
+			void Conv2D::propogateMut(Tensor& input) const
+			{
+				assert(input.getDims() == 2 && input.getShape(1) == conv.getInputSize() && "Input shape does not match convolution shape");
+
+				// Rows of the GEMM are (sample, pixel) with samples fastest, exactly the column-major layout of (sample, filter, pixel) output rows
+				size_t batch = input.getShape(0);
+				size_t outputSize = weights.getShape(1) * conv.getOutHeight() * conv.getOutWidth();
+				Tensor patches;
+				if (batch <= PROPOGATE_ROW_BLOCK)
+				{
+					patches.im2col(input, conv);
+					propogateColumns(patches, input);
+					input.reshape({ batch, outputSize });
+					return;
+				}
+
+				// im2col holds every row patch size times over, so large inputs are lowered a block of rows at a time
+				// Each block's output columns are copied into their rows of the full output
+				std::vector<float> result(batch * outputSize);
+				std::vector<size_t> indices;
+				Tensor block;
+				Tensor blockOutput;
+				for (size_t start = 0; start < batch; start += PROPOGATE_ROW_BLOCK)
+				{
+					size_t rows = std::min(PROPOGATE_ROW_BLOCK, batch - start);
+					indices.resize(rows);
+					std::iota(indices.begin(), indices.end(), start);
+					block.sample(input, 0, indices);
+					patches.im2col(block, conv);
+					propogateColumns(patches, blockOutput);
+					const std::vector<float>& values = blockOutput.getData();
+					for (size_t col = 0; col < outputSize; col++)
+					{
+						std::copy(values.begin() + col * rows, values.begin() + (col + 1) * rows, result.begin() + col * batch + start);
+					}
+				}
+				input = Tensor({ batch, outputSize }, std::move(result));
+			}
+
+			const Tensor* Conv2D::propogatePtr(const Tensor* input)
+			{
+				assert(input->getDims() == 2 && input->getShape(1) == conv.getInputSize() && "Input shape does not match convolution shape");
+
+				// Lower to one GEMM over the whole batch, columns is retained for backprop
 				this->input = input;
-				output = input->mapped([](float x) { return std::max(0.0f, x); });
+				size_t batch = input->getShape(0);
+				columns.im2col(*input, conv);
+				propogateColumns(columns, output);
+				output.reshape({ batch, weights.getShape(1) * conv.getOutHeight() * conv.getOutWidth() });
 				return &output;
 			}
 
-			void ReLU::backpropogate(const Tensor* gradOutput)
+			void Conv2D::propogateColumns(const Tensor& patches, Tensor& destination) const
 			{
-				// Calculate grad output to input * grad output
-				gradInput = input->mapped([](float x) { return x > 0 ? 1.0f : 0.0f; }) * (*gradOutput);
+				// destination ((rows * pixels) x filters) = patches * weights + bias
+				if (backend::get().prefersUnpackedWeights()) destination.gemmBiasActivate(patches, weights, bias, backend::Activation::Identity);
+				else destination.gemmBiasActivate(patches, getPackedWeights(), bias, backend::Activation::Identity);
 			}
 
-			BasePtr ReLU::clone() const
+			void Conv2D::backpropogate(const Tensor* gradOutput)
 			{
-				return std::make_shared<ReLU>();
+				size_t batch = input->getShape(0);
+				size_t pixels = conv.getOutHeight() * conv.getOutWidth();
+				assert(gradOutput->getDims() == 2 && gradOutput->getShape(0) == batch && gradOutput->getShape(1) == weights.getShape(1) * pixels && "gradOutput shape does not match output shape");
+
+				// View gradOutput as the (batch * pixels x filters) rows of the forward GEMM
+				gradRows.reshape(*gradOutput, { batch * pixels, weights.getShape(1) });
+
+				// Calculate pd to weights and bias as average of batches, summed over every pixel a filter was applied at
+				float batchScale = 1.0f / (float)batch;
+				gradWeights.gemm(batchScale, columns, gradRows, 0.0f, true, false);
+				if (bias.getSize() > 0) gradBias.sumRows(batchScale, gradRows, 0.0f);
+
+				// Calculate pd to patches = gradRows * weights^T then sum overlapping patches back into the input
+				gradColumns.gemm(1.0f, gradRows, weights, 0.0f, false, true);
+				gradInput.col2im(gradColumns, conv);
 			}
 
-			void ReLU::serialize(std::ostream& os) const
+			double Conv2D::getForwardFlops() const
 			{
-				os << "ReLU\n";
+				// columns * weights then the bias, once per output pixel
+				double rows = (double)columns.getShape(0);
+				return 2.0 * rows * weights.getSize() + rows * bias.getSize();
 			}
-		}
 
-		namespace Layer
-		{
-			void Sigmoid::propogateMut(Tensor& input) const
+			double Conv2D::getBackwardFlops() const
 			{
-				// Mutably propogate input with Sigmoid activation
-				input.map([this](float x) { return sigmoid(x); });
+				// gradColumns and gradWeights products, bias row sums then col2im adding each patch value back
+				double rows = (double)columns.getShape(0);
+				return 4.0 * rows * weights.getSize() + rows * bias.getSize() + (double)columns.getSize();
 			}
 
-			const Tensor* Sigmoid::propogatePtr(const Tensor* input)
+			void Conv2D::getParameters(std::vector<Parameter>& parameters)
 			{
-				// Propogate input with Sigmoid activation
-				// Retain input and output for backprop
-				this->input = input;
-				output = input->mapped([this](float x) { return sigmoid(x); });
-				return &output;
+				parameters.push_back({ &weights, &gradWeights });
+				if (bias.getSize() > 0) parameters.push_back({ &bias, &gradBias });
 			}
 
-			void Sigmoid::backpropogate(const Tensor* gradOutput)
+			void Conv2D::onParametersUpdated()
 			{
-				// Calculate grad output to input * grad output
-				gradInput = input->mapped([this](float x)
+				isPackedValid = false;
+			}
+
+			void Conv2D::shareParameters(const Base* source)
+			{
+				// See Dense::shareParameters
+				if (source == nullptr)
+				{
+					weights = Tensor::ZERO;
+					bias = Tensor::ZERO;
+				}
+				else
 				{
-					float sv = sigmoid(x);
-					return sv * (1.0f - sv);
-				}) * (*gradOutput);
+					const Conv2D& other = dynamic_cast<const Conv2D&>(*source);
+					weights = other.weights;
+					bias = other.bias;
+				}
+				isPackedValid = false;
 			}
 
-			BasePtr Sigmoid::clone() const
+			void Conv2D::reduceGradients(const Base* other, float otherScale, float scale)
 			{
-				return std::make_shared<Sigmoid>();
+				if (other == nullptr)
+				{
+					gradWeights.mult(scale);
+					if (bias.getSize() > 0) gradBias.mult(scale);
+					return;
+				}
+
+				const Conv2D& conv2D = dynamic_cast<const Conv2D&>(*other);
+				gradWeights.axpby(otherScale, conv2D.gradWeights, scale);
+				if (bias.getSize() > 0) gradBias.axpby(otherScale, conv2D.gradBias, scale);
 			}
 
-			void Sigmoid::serialize(std::ostream& os) const
+			void Conv2D::bindParameters(Base* source)
 			{
-				os << "Sigmoid\n";
+				// See Dense::bindParameters
+				if (source == nullptr)
+				{
+					weights.unbindView();
+					bias.unbindView();
+				}
+				else
+				{
+					Conv2D& other = dynamic_cast<Conv2D&>(*source);
+					weights.bindView(other.weights);
+					if (other.bias.getSize() > 0) bias.bindView(other.bias);
+				}
+				isPackedValid = false;
+			}
+
+			const PackedMatrix& Conv2D::getPackedWeights() const
+			{
+				// See Dense::getPackedWeights
+				if (!isPackedValid.load(std::memory_order_acquire))
+				{
+					std::lock_guard<std::mutex> lock(packMutex);
+					if (!isPackedValid.load(std::memory_order_relaxed))
+					{
+						weights.packPanels(packedWeights);
+						isPackedValid.store(true, std::memory_order_release);
+					}
+				}
+				return packedWeights;
+			}
+
+			void Conv2D::print() const
+			{
+				printf("Conv2D: %zd x %zd x %zd, kernel %zd, stride %zd, padding %zd\n", conv.channels, conv.height, conv.width, conv.kernel, conv.stride, conv.padding);
+				weights.print("Weights:");
+				bias.print("Bias:");
+			}
+
+			BasePtr Conv2D::clone() const
+			{
+				return std::make_shared<Conv2D>(*this);
+			}
+
+			void Conv2D::serialize(std::ostream& os) const
+			{
+				os << "Conv2D\n";
+				os << conv.channels << " " << conv.height << " " << conv.width << " " << conv.kernel << " " << conv.stride << " " << conv.padding << "\n";
+				weights.serialize(os);
+				bias.serialize(os);
 			}
 		}
 
 		namespace Layer
 		{
-			void TanH::propogateMut(Tensor& input) const
+			void Activation::propogateMut(Tensor& input) const
 			{
-				// Mutably propogate input with TanH activation
-				input.map([](float x) { return tanhf(x); });
+				// Mutably propogate input with activation
+				input.activate(fn);
 			}
 
-			const Tensor* TanH::propogatePtr(const Tensor* input)
+			const Tensor* Activation::propogatePtr(const Tensor* input)
 			{
-				// Propogate input with TanH activation
-				// Retain input and output for backprop
+				// Propogate input with activation
+				// Retain output for backprop
 				this->input = input;
-				output = input->mapped([](float x) { return tanhf(x); });
+				output.activate(fn, *input);
 				return &output;
 			}
 
-			void TanH::backpropogate(const Tensor* gradOutput)
+			const Tensor* Activation::propogateFused(const Tensor* input, Dense& dense)
+			{
+				// Dense applies this activation in its kernel, straight into output
+				this->input = nullptr;
+				dense.propogateInto(input, fn, output);
+				return &output;
+			}
+
+			void Activation::backpropogate(const Tensor* gradOutput)
 			{
 				// Calculate grad output to input * grad output
-				gradInput = input->mapped([](float x)
-				{
-					float th = tanhf(x);
-					return 1.0f - (th * th);
-				}) * (*gradOutput);
+				gradInput.activationGrad(fn, output, *gradOutput);
+			}
+
+			BasePtr ReLU::clone() const
+			{
+				return std::make_shared<ReLU>();
+			}
+
+			void ReLU::serialize(std::ostream& os) const
+			{
+				os << "ReLU\n";
+			}
+
+			BasePtr Sigmoid::clone() const
+			{
+				return std::make_shared<Sigmoid>();
+			}
+
+			void Sigmoid::serialize(std::ostream& os) const
+			{
+				os << "Sigmoid\n";
 			}
 
 			BasePtr TanH::clone() const
@@ -266,87 +609,39 @@ namespace tbml
 		{
 			void Softmax::propogateMut(Tensor& input) const
 			{
-				auto shape = input.getShape();
-				assert(shape.size() == 2);
-
-				// Independent per batch
-				for (size_t row = 0; row < shape[0]; row++)
-				{
-					// Calculate max of batch for stability
-					float max = input(row, 0);
-					for (size_t i = 1; i < shape[1]; i++) max = std::max(max, input(row, i));
+				assert(input.getDims() == 2);
 
-					// SoftMax of each element in batch = e^(X(i) - max) / Σ e^(X(i) - max)
-					float sum = 0.0;
-					for (size_t i = 0; i < shape[1]; i++)
-					{
-						input(row, i) = std::exp(input(row, i) - max);
-						sum += input(row, i);
-					}
-					for (size_t i = 0; i < shape[1]; i++)
-					{
-						input(row, i) /= sum;
-					}
-				}
+				// Mutably propogate input with SoftMax activation, independent per row
+				input.softmax();
 			}
 
 			const Tensor* Softmax::propogatePtr(const Tensor* input)
 			{
-				auto shape = input->getShape();
-				assert(shape.size() == 2);
+				assert(input->getDims() == 2);
 
 				// Propogate input with SoftMax activation
 				// Retain input and output for backprop
 				this->input = input;
-
-				// Independent per batch
-				output = Tensor(shape, 0);
-				for (size_t row = 0; row < shape[0]; row++)
-				{
-					// Calculate max of batch for stability
-					float max = input->at(row, 0);
-					for (size_t i = 1; i < shape[1]; i++) max = std::max(max, input->at(row, i));
-
-					// SoftMax of each element in batch = e^(X(i) - max) / Σ e^(X(i) - max)
-					float sum = 0.0;
-					for (size_t i = 0; i < shape[1]; i++)
-					{
-						output(row, i) = std::exp(input->at(row, i) - max);
-						sum += output.at(row, i);
-					}
-					for (size_t i = 0; i < shape[1]; i++)
-					{
-						output(row, i) /= sum;
-					}
-				}
+				output.softmax(*input);
 				return &output;
 			}
 
 			void Softmax::backpropogate(const Tensor* gradOutput)
 			{
-				auto shape = output.getShape();
-				assert(shape.size() == 2);
+				assert(output.getDims() == 2);
 
-				// Calculate grad output to input * grad output
-				gradInput = Tensor(input->getShape(), 0);
+				// Calculate grad output to input * grad output, independent per row
+				// Σj Zj * (kronekerDelta(i, j) - Zi) * gradOutput(j) = Zi * (gradOutput(i) - Σj Zj * gradOutput(j))
+				gradInput.softmaxGrad(output, *gradOutput);
+			}
 
-				// Independent per row
-				for (size_t row = 0; row < shape[0]; row++)
-				{
-					// For each neuron i
-					for (size_t i = 0; i < shape[1]; i++)
-					{
-						float Zi = output(row, i);
-						float sum = 0.0;
-						for (size_t j = 0; j < shape[1]; j++)
-						{
-							float Zj = output(row, j);
-							int kronekerDelta = (i == j) ? 1 : 0;
-							float dSij = (Zj * (kronekerDelta - Zi));
-							gradInput(row, i) += dSij * gradOutput->at(row, j);
-						}
-					}
-				}
+			float Softmax::backpropogateCrossEntropy(const Tensor& expected)
+			{
+				assert(output.getDims() == 2);
+
+				// Softmax then cross entropy has grad to input = output - expected
+				// Loss is recalculated from the input with log-sum-exp for stability
+				return gradInput.softmaxCrossEntropyGrad(*input, expected);
 			}
 
 			BasePtr Softmax::clone() const
@@ -384,16 +679,16 @@ namespace tbml
 
 		void TensorBatcher::loadBatches()
 		{
-			// Setup all batches
-			inputBatches.clear();
-			expectedBatches.clear();
+			// Setup all batches, reusing their storage after the first load
+			inputBatches.resize(batchCount);
+			expectedBatches.resize(batchCount);
 			for (size_t i = 0; i < batchCount; i++)
 			{
 				size_t start = i * this->batchSize;
 				size_t end = std::min(start + this->batchSize, input.getShape(0));
-				std::vector<size_t> batchIndices(indices.begin() + start, indices.begin() + end);
-				inputBatches.push_back(input.sample(0, batchIndices));
-				expectedBatches.push_back(expected.sample(0, batchIndices));
+				batchIndices.assign(indices.begin() + start, indices.begin() + end);
+				inputBatches[i].sample(input, 0, batchIndices);
+				expectedBatches[i].sample(expected, 0, batchIndices);
 			}
 		}
 
@@ -408,80 +703,809 @@ namespace tbml
 
 			// Copy to local, propogate layers mutably
 			Tensor current = input;
-			for (size_t i = 0; i < layers.size(); i++) layers[i]->propogateMut(current);
+			propogateMut(current);
 			return current;
 		}
 
 		void NeuralNetwork::propogateMut(Tensor& input) const
 		{
 			if (layers.size() == 0) return;
-
-			// Directly propogate layers with mutable input
-			for (size_t i = 0; i < layers.size(); i++) layers[i]->propogateMut(input);
+			propogateMutRange(input, 0, layers.size());
 		}
 
 		const Tensor* NeuralNetwork::propogatePtr(const Tensor* input)
 		{
 			if (layers.size() == 0) return nullptr;
+			return propogateRange(input, 0, layers.size());
+		}
+
+		Tensor NeuralNetwork::propogatePipelined(const Tensor& input, size_t stageCount, size_t microBatchSize) const
+		{
+			if (layers.size() == 0) return Tensor(Tensor::ZERO);
+
+			// Split rows into micro-batches which flow through the stages concurrently
+			assert(microBatchSize > 0);
+			Pipeline pipeline(partitionStages(stageCount), 0);
+			size_t rows = input.getShape(0);
+			if (rows == 0) return propogate(input);
+			size_t microBatchCount = (rows + microBatchSize - 1) / microBatchSize;
+			std::vector<Tensor> microBatches(microBatchCount);
+
+			// Stage 0 samples each micro-batch, every stage propogates it through its layers in place
+			// Stages block on each other's queues so need a thread each, a smaller team (nested regions, thread limits) runs serially below
+			bool isTeamComplete = true;
+			#pragma omp parallel num_threads((int)pipeline.getStageCount())
+			{
+				if (omp_get_num_threads() != (int)pipeline.getStageCount())
+				{
+					if (omp_get_thread_num() == 0) isTeamComplete = false;
+				}
+				else
+				{
+					size_t s = (size_t)omp_get_thread_num();
+					std::vector<size_t> indices;
+					for (size_t k = 0; k < microBatchCount; k++)
+					{
+						size_t m = s == 0 ? k : pipeline.forwardQueues[s]->pop();
+						if (s == 0)
+						{
+							size_t start = m * microBatchSize;
+							indices.resize(std::min(start + microBatchSize, rows) - start);
+							std::iota(indices.begin(), indices.end(), start);
+							microBatches[m].sample(input, 0, indices);
+						}
+						propogateMutRange(microBatches[m], pipeline.stageBounds[s], pipeline.stageBounds[s + 1]);
+						if (s + 1 < pipeline.getStageCount()) pipeline.forwardQueues[s + 1]->push(m);
+					}
+				}
+			}
+			if (!isTeamComplete)
+			{
+				std::vector<size_t> indices;
+				for (size_t m = 0; m < microBatchCount; m++)
+				{
+					size_t start = m * microBatchSize;
+					indices.resize(std::min(start + microBatchSize, rows) - start);
+					std::iota(indices.begin(), indices.end(), start);
+					microBatches[m].sample(input, 0, indices);
+					propogateMutRange(microBatches[m], 0, layers.size());
+				}
+			}
+
+			// Gather micro-batch rows back into one column-major output
+			size_t cols = microBatches[0].getShape(1);
+			std::vector<float> output(rows * cols);
+			for (size_t m = 0; m < microBatchCount; m++)
+			{
+				const std::vector<float>& data = microBatches[m].getData();
+				size_t microRows = microBatches[m].getShape(0);
+				for (size_t col = 0; col < cols; col++)
+				{
+					std::copy(data.begin() + col * microRows, data.begin() + (col + 1) * microRows, output.begin() + col * rows + m * microBatchSize);
+				}
+			}
+			return Tensor({ rows, cols }, std::move(output));
+		}
+
+		Evaluation NeuralNetwork::evaluate(const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, size_t chunkSize, int threadCount) const
+		{
+			if (layers.size() == 0) return Evaluation();
+			if (input.getShape(0) != expected.getShape(0)) throw std::runtime_error("Input and expected row counts do not match");
+			if (chunkSize == 0) throw std::runtime_error("chunkSize must be at least 1");
+			trace::Scope scope("evaluate");
+
+			// Layers that cannot be compiled fall back to propogating a copy of each chunk through the network
+			InferenceModel model;
+			try { model = compileForInference(); }
+			catch (const std::runtime_error&) {}
+
+			// Only one chunk per thread is live at a time, so memory scales with chunkSize and threads rather than rows
+			size_t rows = input.getShape(0);
+			int chunkCount = (int)((rows + chunkSize - 1) / chunkSize);
+			int threads = threadCount == -1 ? omp_get_num_procs() : std::max(threadCount, 1);
+			threads = std::min(threads, std::max(chunkCount, 1));
+			float loss = 0.0f;
+			size_t correct = 0;
+
+			#pragma omp parallel num_threads(threads) reduction(+:loss, correct)
+			{
+				// Chunk tensors and indices reuse their storage, compiled activations reuse a per thread scratch arena
+				Tensor chunkInput;
+				Tensor chunkExpected;
+				Tensor chunkOutput;
+				std::vector<size_t> indices;
+				std::vector<uint32_t> predictedClasses;
+				std::vector<uint32_t> expectedClasses;
+				indices.reserve(chunkSize);
+
+				#pragma omp for schedule(dynamic)
+				for (int chunk = 0; chunk < chunkCount; chunk++)
+				{
+					trace::Scope chunkScope("evaluate chunk", "chunk", chunk);
+					size_t start = chunk * chunkSize;
+					indices.resize(std::min(start + chunkSize, rows) - start);
+					std::iota(indices.begin(), indices.end(), start);
+					chunkExpected.sample(expected, 0, indices);
+
+					// Compiled models write into chunkOutput's storage, otherwise the chunk is sampled straight into it and propogated in place
+					if (!model.isEmpty())
+					{
+						chunkInput.sample(input, 0, indices);
+						model.propogate(chunkInput, chunkOutput);
+					}
+					else
+					{
+						chunkOutput.sample(input, 0, indices);
+						propogateMut(chunkOutput);
+					}
+
+					// Chunk losses add up to the loss over every row, mean losses are weighted by the chunk's share of rows
+					if (lossFn != nullptr) loss += lossFn->calculate(chunkOutput, chunkExpected) * lossFn->getSubsetWeight(indices.size(), rows);
+					chunkOutput.argmaxRows(predictedClasses);
+					chunkExpected.argmaxRows(expectedClasses);
+					for (size_t row = 0; row < indices.size(); row++) correct += predictedClasses[row] == expectedClasses[row] ? 1 : 0;
+				}
+			}
+
+			Evaluation evaluation;
+			evaluation.rows = rows;
+			evaluation.loss = loss;
+			evaluation.accuracy = rows > 0 ? (float)correct / rows : 0.0f;
+			return evaluation;
+		}
+
+		void NeuralNetwork::propogateMutRange(Tensor& input, size_t first, size_t last) const
+		{
+			// Directly propogate layers [first, last) with mutable input
+			for (size_t i = first; i < last; i++)
+			{
+				Layer::Dense* dense;
+				Layer::Activation* activation;
+				if (i + 1 < last && getFusedPair(i, dense, activation))
+				{
+					dense->propogateMut(input, activation->getFunction());
+					i++;
+				}
+				else layers[i]->propogateMut(input);
+			}
+		}
 
-			// Propogate layers with referencable tensor
+		const Tensor* NeuralNetwork::propogateRange(const Tensor* input, size_t first, size_t last)
+		{
+			// Propogate layers [first, last) with referencable tensor
 			// Used to track values for backpropogation
-			layers[0]->propogatePtr(input);
-			for (size_t i = 1; i < layers.size(); i++) layers[i]->propogatePtr(layers[i - 1]->getOutputPtr());
-			return layers[layers.size() - 1]->getOutputPtr();
+			const Tensor* current = input;
+			for (size_t i = first; i < last; i++)
+			{
+				trace::Scope scope("forward", "layer", i);
+				Profiler::Clock::time_point start = profiler != nullptr ? Profiler::Clock::now() : Profiler::Clock::time_point();
+				size_t profiled = i;
+				Layer::Dense* dense;
+				Layer::Activation* activation;
+				if (i + 1 < last && getFusedPair(i, dense, activation))
+				{
+					current = activation->propogateFused(current, *dense);
+					i++;
+				}
+				else current = layers[i]->propogatePtr(current);
+
+				// A fused pair is timed as the Dense
+				if (profiler != nullptr)
+				{
+					double flops = 0.0;
+					for (size_t j = profiled; j <= i; j++) flops += layers[j]->getForwardFlops();
+					profiler->add(profiled, Profiler::Phase::Forward, start, flops);
+				}
+			}
+			return current;
+		}
+
+		void NeuralNetwork::backpropogateLayers(size_t first, size_t last)
+		{
+			// Backpropogate layers [first, last) from the gradient already in layer last
+			for (int i = (int)last - 1; i >= (int)first; i--)
+			{
+				trace::Scope scope("backward", "layer", i);
+				Profiler::Clock::time_point start = profiler != nullptr ? Profiler::Clock::now() : Profiler::Clock::time_point();
+				layers[i]->backpropogate(layers[i + 1]->getGradInputPtr());
+				if (profiler != nullptr) profiler->add(i, Profiler::Phase::Backward, start, layers[i]->getBackwardFlops());
+			}
+		}
+
+		float NeuralNetwork::backpropogateLoss(const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss)
+		{
+			// Calculate loss of the last output and backpropogate it to the last layer
+			// Loss is profiled in the record after the layers and TensorBatcher, a fused Softmax backward with it
+			trace::Scope scope("loss");
+			Layer::Base& outputLayer = *layers[layers.size() - 1];
+			size_t lossRecord = layers.size() + 1;
+			Profiler::Clock::time_point start = profiler != nullptr ? Profiler::Clock::now() : Profiler::Clock::time_point();
+			if (fuseSoftmaxLoss)
+			{
+				float loss = static_cast<Layer::Softmax&>(outputLayer).backpropogateCrossEntropy(expected);
+				if (profiler != nullptr) profiler->add(lossRecord, Profiler::Phase::Backward, start, outputLayer.getBackwardFlops());
+				return loss;
+			}
+
+			// Loss and its gradient in one pass, the gradient reusing its storage between batches
+			float loss = lossFn->calculateWithGradient(*outputLayer.getOutputPtr(), expected, gradLoss);
+			if (profiler != nullptr)
+			{
+				profiler->add(lossRecord, Profiler::Phase::Backward, start);
+				start = Profiler::Clock::now();
+			}
+			outputLayer.backpropogate(&gradLoss);
+			if (profiler != nullptr) profiler->add(layers.size() - 1, Profiler::Phase::Backward, start, outputLayer.getBackwardFlops());
+			return loss;
+		}
+
+		std::vector<size_t> NeuralNetwork::partitionStages(size_t stageCount) const
+		{
+			// Cut so each stage holds about an equal share of parameters, a proxy for FLOPs per row
+			// Fused pairs are never split, so fewer stages than asked for can be returned
+			size_t total = getParameterCount();
+			size_t acc = 0;
+			std::vector<size_t> bounds = { 0 };
+			for (size_t i = 0; i + 1 < layers.size(); i++)
+			{
+				Layer::Dense* dense;
+				Layer::Activation* activation;
+				acc += layers[i]->getParameterCount();
+				if (bounds.size() < stageCount && !getFusedPair(i, dense, activation) && acc * stageCount >= total * bounds.size())
+				{
+					bounds.push_back(i + 1);
+				}
+			}
+			bounds.push_back(layers.size());
+			return bounds;
+		}
+
+		std::vector<size_t> NeuralNetwork::partitionSegments(const std::vector<size_t>& checkpointLayers) const
+		{
+			// A checkpoint on layer i keeps its output so the next segment starts at i + 1
+			// Fused Dense have no output of their own so their activation is kept instead, the final output always is
+			std::vector<size_t> sorted = checkpointLayers;
+			std::sort(sorted.begin(), sorted.end());
+			std::vector<size_t> bounds = { 0 };
+			for (size_t i : sorted)
+			{
+				Layer::Dense* dense;
+				Layer::Activation* activation;
+				if (getFusedPair(i, dense, activation)) i++;
+				if (i + 1 < layers.size() && i + 1 > bounds.back()) bounds.push_back(i + 1);
+			}
+			bounds.push_back(layers.size());
+			return bounds;
+		}
+
+		size_t NeuralNetwork::getRecomputeEnd(size_t segment) const
+		{
+			// Layers [segmentBounds[segment], end) are recomputed in backprop
+			// The checkpoint ending the segment is still held, as is the Dense fused into it, so neither is recomputed
+			size_t first = segmentBounds[segment];
+			size_t end = segmentBounds[segment + 1] - 1;
+			Layer::Dense* dense;
+			Layer::Activation* activation;
+			if (end > first && getFusedPair(end - 1, dense, activation)) end--;
+			return end;
+		}
+
+		NeuralNetwork::Pipeline::Pipeline(std::vector<size_t>&& stageBounds, size_t backwardCapacity)
+			: stageBounds(std::move(stageBounds))
+		{
+			// Forward queues are bounded so early stages run at most a few micro-batches ahead
+			// Backward queues hold every micro-batch as stages only drain them after their forwards
+			for (size_t s = 0; s < getStageCount(); s++)
+			{
+				forwardQueues.push_back(std::make_unique<BoundedQueue<size_t>>(PIPELINE_QUEUE_CAPACITY));
+				backwardQueues.push_back(std::make_unique<BoundedQueue<size_t>>(std::max(backwardCapacity, (size_t)1)));
+			}
+		}
+
+		float NeuralNetwork::computeGradients(const Tensor* input, const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss)
+		{
+			// Propogate input then calculate loss and backpropogate it through each layer
+			propogatePtr(input);
+			float loss = backpropogateLoss(expected, lossFn, fuseSoftmaxLoss);
+			if (segmentBounds.size() <= 2)
+			{
+				backpropogateLayers(0, layers.size() - 1);
+				return loss;
+			}
+
+			// Only the last segment and checkpoint outputs survived the forward pass
+			// Each earlier segment is propogated again from the checkpoint before it then backpropogated
+			size_t lastSegment = segmentBounds.size() - 2;
+			backpropogateLayers(segmentBounds[lastSegment], layers.size() - 1);
+			for (int k = (int)lastSegment - 1; k >= 0; k--)
+			{
+				size_t first = segmentBounds[k];
+				size_t recomputeEnd = getRecomputeEnd(k);
+				if (recomputeEnd > first) propogateRange(first == 0 ? input : layers[first - 1]->getOutputPtr(), first, recomputeEnd);
+				backpropogateLayers(first, segmentBounds[k + 1]);
+			}
+			return loss;
+		}
+
+		void NeuralNetwork::applyOptimizer(Optimizer& optimizer, const std::vector<Parameter>& parameters)
+		{
+			trace::Scope scope("optimizer");
+			optimizer.step(parameters, profiler.get());
+			for (auto& layer : layers) layer->onParametersUpdated();
+		}
+
+		float NeuralNetwork::trainEpochAsync(std::vector<NeuralNetwork>& replicas, std::vector<OptimizerPtr>& optimizers, const TensorBatcher& batcher, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss)
+		{
+			// Workers pull batches from a shared counter and apply their own updates with no barrier (Hogwild)
+			// Updates race benignly, a forward pass may read weights midway through another worker's update
+			size_t batchCount = batcher.getBatchCount();
+			std::atomic<size_t> nextBatch(0);
+			float epochLoss = 0.0f;
+
+			#pragma omp parallel num_threads((int)replicas.size() + 1) reduction(+:epochLoss)
+			{
+				int r = omp_get_thread_num();
+				NeuralNetwork& replica = r == 0 ? *this : replicas[r - 1];
+				std::vector<Parameter> parameters = replica.getParameters();
+				for (size_t batch = nextBatch++; batch < batchCount; batch = nextBatch++)
+				{
+					trace::Scope scope("batch", "batch", batch);
+					float batchLoss = replica.computeGradients(&batcher.getBatchInput(batch), batcher.getBatchExpected(batch), lossFn, fuseSoftmaxLoss);
+					replica.applyOptimizer(*optimizers[r], parameters);
+					epochLoss += batchLoss / batchCount;
+				}
+			}
+			return epochLoss;
+		}
+
+		float NeuralNetwork::computeGradientsPipelined(std::vector<NeuralNetwork>& replicas, std::vector<Shard>& microBatches, Pipeline& pipeline, const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss)
+		{
+			// Split rows into contiguous micro-batches, micro-batch m runs on replica m so stages never share buffers
+			size_t rows = input.getShape(0);
+			size_t microBatchSize = (rows + microBatches.size() - 1) / microBatches.size();
+			size_t activeCount = (rows + microBatchSize - 1) / microBatchSize;
+			size_t stageCount = pipeline.getStageCount();
+
+			// Replicas read this network's parameters for the step
+			for (auto& replica : replicas)
+			{
+				for (size_t i = 0; i < layers.size(); i++) replica.layers[i]->shareParameters(layers[i].get());
+			}
+
+			// GPipe schedule, each stage propogates every micro-batch then backpropogates every micro-batch
+			// The last stage backpropogates each micro-batch as soon as its forward is done
+			// Stages block on each other's queues so need a thread each, a smaller team (nested regions, thread limits) runs serially below
+			bool isTeamComplete = true;
+			#pragma omp parallel num_threads((int)stageCount)
+			{
+				if (omp_get_num_threads() != (int)stageCount)
+				{
+					if (omp_get_thread_num() == 0) isTeamComplete = false;
+				}
+				else
+				{
+					size_t s = (size_t)omp_get_thread_num();
+					size_t first = pipeline.stageBounds[s];
+					size_t last = pipeline.stageBounds[s + 1];
+					bool isLastStage = s + 1 == stageCount;
+					for (size_t k = 0; k < activeCount; k++)
+					{
+						size_t m = s == 0 ? k : pipeline.forwardQueues[s]->pop();
+						NeuralNetwork& replica = m == 0 ? *this : replicas[m - 1];
+						Shard& microBatch = microBatches[m];
+						const Tensor* stageInput;
+						if (s == 0)
+						{
+							size_t start = m * microBatchSize;
+							microBatch.indices.resize(std::min(start + microBatchSize, rows) - start);
+							std::iota(microBatch.indices.begin(), microBatch.indices.end(), start);
+							microBatch.input.sample(input, 0, microBatch.indices);
+							microBatch.expected.sample(expected, 0, microBatch.indices);
+							stageInput = &microBatch.input;
+						}
+						else stageInput = replica.layers[first - 1]->getOutputPtr();
+						replica.propogateRange(stageInput, first, last);
+
+						if (!isLastStage) pipeline.forwardQueues[s + 1]->push(m);
+						else
+						{
+							microBatch.loss = replica.backpropogateLoss(microBatch.expected, lossFn, fuseSoftmaxLoss);
+							replica.backpropogateLayers(first, last - 1);
+							if (s > 0) pipeline.backwardQueues[s - 1]->push(m);
+						}
+					}
+
+					// Earlier stages backpropogate from the gradient the next stage left in layer last
+					if (!isLastStage)
+					{
+						for (size_t k = 0; k < activeCount; k++)
+						{
+							size_t m = pipeline.backwardQueues[s]->pop();
+							NeuralNetwork& replica = m == 0 ? *this : replicas[m - 1];
+							replica.backpropogateLayers(first, last);
+							if (s > 0) pipeline.backwardQueues[s - 1]->push(m);
+						}
+					}
+				}
+			}
+
+			// Serially each micro-batch runs forward and backward through every layer on its replica, the same work as the stages
+			if (!isTeamComplete)
+			{
+				for (size_t m = 0; m < activeCount; m++)
+				{
+					NeuralNetwork& replica = m == 0 ? *this : replicas[m - 1];
+					Shard& microBatch = microBatches[m];
+					size_t start = m * microBatchSize;
+					microBatch.indices.resize(std::min(start + microBatchSize, rows) - start);
+					std::iota(microBatch.indices.begin(), microBatch.indices.end(), start);
+					microBatch.input.sample(input, 0, microBatch.indices);
+					microBatch.expected.sample(expected, 0, microBatch.indices);
+					replica.propogateRange(&microBatch.input, 0, layers.size());
+					microBatch.loss = replica.backpropogateLoss(microBatch.expected, lossFn, fuseSoftmaxLoss);
+					replica.backpropogateLayers(0, layers.size() - 1);
+				}
+			}
+
+			// Accumulate micro-batch gradients weighted by rows into this network's mean gradient
+			for (size_t m = 1; m < activeCount; m++)
+			{
+				float scale = m == 1 ? microBatches[0].indices.size() / (float)rows : 1.0f;
+				float otherScale = microBatches[m].indices.size() / (float)rows;
+				for (size_t i = 0; i < layers.size(); i++) layers[i]->reduceGradients(replicas[m - 1].layers[i].get(), otherScale, scale);
+			}
+
+			// Release parameters so gradient descent updates them in place
+			for (auto& replica : replicas)
+			{
+				for (auto& layer : replica.layers) layer->shareParameters(nullptr);
+			}
+
+			float loss = 0.0f;
+			for (size_t m = 0; m < activeCount; m++) loss += microBatches[m].loss * lossFn->getSubsetWeight(microBatches[m].indices.size(), rows);
+			return loss;
+		}
+
+		float NeuralNetwork::computeGradientsParallel(std::vector<NeuralNetwork>& replicas, std::vector<Shard>& shards, const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss)
+		{
+			// Split rows into contiguous shards, a short last batch leaves trailing replicas idle
+			int workerCount = (int)shards.size();
+			size_t rows = input.getShape(0);
+			size_t shardSize = (rows + workerCount - 1) / workerCount;
+			int activeCount = (int)((rows + shardSize - 1) / shardSize);
+
+			// Replicas read this network's parameters for the step
+			for (auto& replica : replicas)
+			{
+				for (size_t i = 0; i < layers.size(); i++) replica.layers[i]->shareParameters(layers[i].get());
+			}
+
+			// Each replica computes gradients of its shard, then a tree all-reduce folds them into replica 0
+			// Kernels inside the region run single threaded as nested OpenMP is inactive
+			// A smaller team than asked for (nested regions, thread limits, dynamic teams) has each thread take several replicas
+			#pragma omp parallel num_threads(workerCount)
+			{
+				int thread = omp_get_thread_num();
+				int teamSize = omp_get_num_threads();
+				for (int r = thread; r < activeCount; r += teamSize)
+				{
+					NeuralNetwork& replica = r == 0 ? *this : replicas[r - 1];
+					Shard& shard = shards[r];
+					size_t start = r * shardSize;
+					size_t end = std::min(start + shardSize, rows);
+					shard.indices.resize(end - start);
+					std::iota(shard.indices.begin(), shard.indices.end(), start);
+					shard.input.sample(input, 0, shard.indices);
+					shard.expected.sample(expected, 0, shard.indices);
+					shard.loss = replica.computeGradients(&shard.input, shard.expected, lossFn, fuseSoftmaxLoss);
+				}
+
+				// At stride s replica r += replica r + s, the first level weights each shard by its rows
+				// So replica 0 ends with the mean gradient over the whole batch
+				for (int stride = 1; stride < activeCount; stride *= 2)
+				{
+					#pragma omp barrier
+					for (int r = thread; r < activeCount; r += teamSize)
+					{
+						if (r % (2 * stride) != 0) continue;
+						NeuralNetwork& replica = r == 0 ? *this : replicas[r - 1];
+						NeuralNetwork* other = r + stride < activeCount ? &replicas[r + stride - 1] : nullptr;
+						if (other == nullptr && stride > 1) continue;
+						float scale = stride == 1 ? shards[r].indices.size() / (float)rows : 1.0f;
+						float otherScale = stride == 1 && other != nullptr ? shards[r + stride].indices.size() / (float)rows : 1.0f;
+						trace::Scope scope("reduce", "stride", stride);
+						for (size_t i = 0; i < replica.layers.size(); i++)
+						{
+							replica.layers[i]->reduceGradients(other != nullptr ? other->layers[i].get() : nullptr, otherScale, scale);
+						}
+					}
+				}
+			}
+
+			// Release parameters so gradient descent updates them in place
+			for (auto& replica : replicas)
+			{
+				for (auto& layer : replica.layers) layer->shareParameters(nullptr);
+			}
+
+			float loss = 0.0f;
+			for (int r = 0; r < activeCount; r++) loss += shards[r].loss * lossFn->getSubsetWeight(shards[r].indices.size(), rows);
+			return loss;
+		}
+
+		void NeuralNetwork::planMemory(const std::vector<size_t>& inputShape, const std::vector<size_t>& checkpointLayers)
+		{
+			clearMemoryPlan();
+			if (layers.size() == 0) return;
+
+			// Propogate and backpropogate one zero batch to find every buffer size
+			Tensor probeInput(inputShape, 0.0f);
+			const Tensor* probeOutput = propogatePtr(&probeInput);
+			Tensor probeGrad(probeOutput->getShape(), 0.0f);
+			layers[layers.size() - 1]->backpropogate(&probeGrad);
+			backpropogateLayers(0, layers.size() - 1);
+
+			// Step i is the forward of layer i, backward steps follow segment by segment from the last
+			// Segments before the last are first propogated again, see computeGradients
+			size_t n = layers.size();
+			segmentBounds = partitionSegments(checkpointLayers);
+			size_t segmentCount = segmentBounds.size() - 1;
+			std::vector<size_t> recomputeSteps(n, 0);
+			std::vector<size_t> backwardSteps(n, 0);
+			size_t step = n;
+			for (int k = (int)segmentCount - 1; k >= 0; k--)
+			{
+				if (k + 1 < (int)segmentCount)
+				{
+					for (size_t i = segmentBounds[k]; i < getRecomputeEnd(k); i++) recomputeSteps[i] = step++;
+				}
+				for (size_t i = segmentBounds[k + 1]; i-- > segmentBounds[k];) backwardSteps[i] = step++;
+			}
+
+			// Outputs live until their own backward, gradInput until the backward of the layer before
+			// Recomputed outputs are free between the next layer reading them, or writing a fused output at i + 2, and their recompute
+			// The final output is handed to callers so stays owned, fused Dense write into the next output
+			memoryPlan = std::make_shared<MemoryPlan>();
+			std::vector<std::pair<size_t, size_t>> outputBuffers;
+			std::vector<std::pair<size_t, size_t>> gradInputBuffers;
+			for (size_t i = 0; i + 1 < n; i++)
+			{
+				Layer::Dense* dense;
+				Layer::Activation* activation;
+				size_t size = layers[i]->getOutputPtr()->getSize();
+				if (size == 0 || getFusedPair(i, dense, activation)) continue;
+				bool isRecomputed = i + 1 < segmentBounds[segmentCount - 1] && std::find(segmentBounds.begin(), segmentBounds.end(), i + 1) == segmentBounds.end();
+				if (!isRecomputed) outputBuffers.push_back({ i, memoryPlan->addBuffer(size, i, backwardSteps[i]) });
+				else
+				{
+					outputBuffers.push_back({ i, memoryPlan->addBuffer(size, i, i + 2) });
+					memoryPlan->addLifetime(outputBuffers.back().second, recomputeSteps[i], backwardSteps[i]);
+				}
+			}
+			for (size_t i = 0; i < n; i++)
+			{
+				size_t size = layers[i]->getGradInputPtr()->getSize();
+				if (size == 0) continue;
+				size_t lastStep = i > 0 ? backwardSteps[i - 1] : backwardSteps[i] + 1;
+				gradInputBuffers.push_back({ i, memoryPlan->addBuffer(size, backwardSteps[i], lastStep) });
+			}
+			memoryPlan->allocate();
+
+			for (const auto& buffer : outputBuffers) layers[buffer.first]->bindOutput(memoryPlan->getBuffer(buffer.second), memoryPlan->getBufferSize(buffer.second));
+			for (const auto& buffer : gradInputBuffers) layers[buffer.first]->bindGradInput(memoryPlan->getBuffer(buffer.second), memoryPlan->getBufferSize(buffer.second));
+		}
+
+		void NeuralNetwork::clearMemoryPlan()
+		{
+			// Layers go back to owned buffers before the arena is freed
+			if (memoryPlan == nullptr) return;
+			for (auto& layer : layers)
+			{
+				layer->bindOutput(nullptr, 0);
+				layer->bindGradInput(nullptr, 0);
+			}
+			memoryPlan.reset();
+			segmentBounds.clear();
+		}
+
+		InferenceModel NeuralNetwork::compileForInference() const
+		{
+			// Flatten layers into ops, fusing each Dense with a following activation
+			std::vector<InferenceModel::Op> ops;
+			for (size_t i = 0; i < layers.size(); i++)
+			{
+				Layer::Dense* fusedDense;
+				Layer::Activation* fusedActivation;
+				const Layer::Dense* dense = dynamic_cast<const Layer::Dense*>(layers[i].get());
+				const Layer::Activation* activation = dynamic_cast<const Layer::Activation*>(layers[i].get());
+				InferenceModel::Op op;
+				if (dense != nullptr)
+				{
+					op.type = InferenceModel::Op::Type::Dense;
+					op.inputSize = dense->getWeights().getShape(0);
+					op.outputSize = dense->getWeights().getShape(1);
+					op.weights = dense->getWeights();
+					op.bias = dense->getBias();
+					const SparseMatrix* sparse = dense->getSparseWeights();
+					if (sparse != nullptr) op.sparseWeights = *sparse;
+					else op.packedWeights = dense->getPackedWeights();
+					if (getFusedPair(i, fusedDense, fusedActivation))
+					{
+						op.fn = fusedActivation->getFunction();
+						i++;
+					}
+				}
+				else if (activation != nullptr)
+				{
+					op.type = InferenceModel::Op::Type::Activation;
+					op.fn = activation->getFunction();
+				}
+				else if (dynamic_cast<Layer::Softmax*>(layers[i].get()) != nullptr)
+				{
+					op.type = InferenceModel::Op::Type::Softmax;
+				}
+				else throw std::runtime_error("Layer type cannot be compiled for inference");
+				ops.push_back(std::move(op));
+			}
+			return InferenceModel(std::move(ops));
+		}
+
+		bool NeuralNetwork::getFusedPair(size_t i, Layer::Dense*& dense, Layer::Activation*& activation) const
+		{
+			// Dense followed by an elementwise activation runs as a single kernel
+			if (i + 1 >= layers.size()) return false;
+			dense = dynamic_cast<Layer::Dense*>(layers[i].get());
+			activation = dynamic_cast<Layer::Activation*>(layers[i + 1].get());
+			return dense != nullptr && activation != nullptr;
 		}
 
 		void NeuralNetwork::train(const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr lossFn, const TrainingConfig& config)
 		{
 			// Setup data batchers
+			trace::Scope trainScope("train");
 			TensorBatcher batcher(input, expected, config.batchSize, false, false);
 			size_t maxBatch = batcher.getBatchCount();
 
+			// Softmax into cross entropy backpropogates in one fused pass
+			bool fuseSoftmaxLoss = dynamic_cast<Layer::Softmax*>(layers[layers.size() - 1].get()) != nullptr
+				&& dynamic_cast<const fn::CrossEntropy*>(lossFn.get()) != nullptr;
+
+			// Data parallel replicas each take a shard of every batch, this network is replica 0
+			// Asynchronous replicas take whole batches and write into this network's parameters
+			// Pipelined replicas each take a micro-batch, running through stages on their own threads
+			size_t batchSize = batcher.getBatchSize();
+			size_t threadCount = config.threadCount == -1 ? (size_t)omp_get_num_procs() : (size_t)std::max(config.threadCount, 1);
+			bool isAsync = config.asynchronous && threadCount > 1;
+			bool isPipelined = config.pipelineStages > 1;
+			if (isPipelined && threadCount > 1) throw std::runtime_error("Pipeline and data parallel training cannot be combined");
+
+			// Keep only checkpointed layer outputs between forward and backward, every sqrt(layers) if not given
+			std::vector<size_t> checkpointLayers = config.checkpointLayers;
+			if (checkpointLayers.empty() && config.checkpointInterval != 0)
+			{
+				size_t interval = config.checkpointInterval == -1 ? (size_t)std::round(std::sqrt((float)layers.size())) : (size_t)std::max(config.checkpointInterval, 1);
+				for (size_t i = interval - 1; i + 1 < layers.size(); i += interval) checkpointLayers.push_back(i);
+			}
+			bool isCheckpointed = !checkpointLayers.empty();
+			if (isPipelined && isCheckpointed) throw std::runtime_error("Pipeline training cannot be combined with checkpointing");
+			std::unique_ptr<Pipeline> pipeline;
+			if (isPipelined)
+			{
+				size_t microBatchCount = std::min((size_t)std::max(config.microBatchCount, 1), batchSize);
+				pipeline = std::make_unique<Pipeline>(partitionStages(config.pipelineStages), microBatchCount);
+				threadCount = microBatchCount;
+			}
+			else threadCount = std::min(threadCount, isAsync ? maxBatch : batchSize);
+			size_t shardSize = isAsync ? batchSize : (batchSize + threadCount - 1) / threadCount;
+			std::vector<NeuralNetwork> replicas;
+			std::vector<Shard> shards(threadCount);
+			for (size_t i = 1; i < threadCount; i++) replicas.push_back(clone());
+			if (isAsync)
+			{
+				for (auto& replica : replicas)
+				{
+					for (size_t i = 0; i < layers.size(); i++) replica.layers[i]->bindParameters(layers[i].get());
+				}
+			}
+
+			// Plan layer buffers into one arena for the batch shape so batches do not allocate
+			// When checkpointing the arena keeping every output is planned first to report against
+			std::vector<size_t> batchShape = input.getShape();
+			batchShape[0] = shardSize;
+			size_t fullArenaSize = 0;
+			if (isCheckpointed && config.logLevel > 0)
+			{
+				planMemory(batchShape);
+				fullArenaSize = memoryPlan->getArenaSize();
+			}
+			planMemory(batchShape, checkpointLayers);
+			for (auto& replica : replicas) replica.planMemory(batchShape, checkpointLayers);
+
+			// Only this network's optimizer steps, except asynchronous replicas which each step their own
+			OptimizerPtr prototype = config.optimizer != nullptr ? config.optimizer : std::make_shared<SGD>(config.learningRate, config.momentumRate);
+			std::vector<OptimizerPtr> optimizers(isAsync ? threadCount : 1);
+			for (auto& optimizer : optimizers) optimizer = prototype->clone();
+			std::vector<Parameter> parameters = getParameters();
+			if (config.logLevel > 0)
+			{
+				printf("Memory plan: %zd buffers in %.1fKB arena, %.1fKB unplanned\n", memoryPlan->getBufferCount(),
+					memoryPlan->getArenaSize() * sizeof(float) / 1024.0f, memoryPlan->getUnplannedSize() * sizeof(float) / 1024.0f);
+			}
+
+			// Profile one record per layer then TensorBatcher and Loss, fused layers are timed with what they fuse into
+			profiler = config.profiler;
+			size_t batcherRecord = layers.size();
+			if (profiler != nullptr)
+			{
+				std::vector<std::string> names;
+				for (size_t i = 0; i < layers.size(); i++)
+				{
+					Layer::Dense* dense;
+					Layer::Activation* activation;
+					std::string name = std::to_string(i) + " " + layers[i]->getName();
+					if (i > 0 && getFusedPair(i - 1, dense, activation)) name += " (fused)";
+					else if (i + 1 == layers.size() && fuseSoftmaxLoss) name += " (fused loss)";
+					names.push_back(name);
+				}
+				names.push_back("TensorBatcher");
+				names.push_back("Loss");
+				profiler->reset(std::move(names));
+			}
+
 			// Train for each batch for each epoch
 			size_t maxEpoch = config.maxEpoch == -1 ? MAX_EPOCHS : config.maxEpoch;
-			if (config.logLevel > 0) printf("Training started for %zd epochs\n", maxEpoch);
+			if (config.logLevel > 0) printf("Training started for %zd epochs with %s\n", maxEpoch, optimizers[0]->getName().c_str());
 			std::chrono::steady_clock::time_point tTrainStart = std::chrono::steady_clock::now();
 			std::chrono::steady_clock::time_point tEpochStart = tTrainStart;
 			std::chrono::steady_clock::time_point tBatchStart = tTrainStart;
 
 			size_t epoch = 0;
+			size_t sampleCount = 0;
 			for (; epoch < maxEpoch; epoch++)
 			{
-				batcher.shuffleAndLoad();
+				trace::Scope epochScope("epoch", "epoch", epoch);
+				Profiler::Clock::time_point tLoadStart = profiler != nullptr ? Profiler::Clock::now() : Profiler::Clock::time_point();
+				{
+					trace::Scope loadScope("TensorBatcher");
+					batcher.shuffleAndLoad();
+				}
+				if (profiler != nullptr) profiler->add(batcherRecord, Profiler::Phase::Other, tLoadStart);
 				float epochLoss = 0.0f;
-				for (size_t batch = 0; batch < maxBatch; batch++)
+				if (isAsync)
+				{
+					epochLoss = trainEpochAsync(replicas, optimizers, batcher, lossFn, fuseSoftmaxLoss);
+					sampleCount += input.getShape(0);
+				}
+				else
 				{
-					// Get input and expected batch
-					const Tensor& inputBatch = batcher.getBatchInput(batch);
-					const Tensor& expectedBatch = batcher.getBatchExpected(batch);
+					for (size_t batch = 0; batch < maxBatch; batch++)
+					{
+						trace::Scope batchScope("batch", "batch", batch);
 
-					// Propogate input then calculate loss
-					const Tensor* predicted = propogatePtr(&inputBatch);
-					float batchLoss = lossFn->calculate(*predicted, expectedBatch);
-					epochLoss += batchLoss / maxBatch;
+						// Get input and expected batch
+						const Tensor& inputBatch = batcher.getBatchInput(batch);
+						const Tensor& expectedBatch = batcher.getBatchExpected(batch);
 
-					// Backpropogate loss then through each layer
-					const Tensor gradLossToOut = lossFn->derivative(*predicted, expectedBatch);
-					layers[layers.size() - 1]->backpropogate(&gradLossToOut);
-					for (int i = (int)layers.size() - 2; i >= 0; i--)
-					{
-						layers[i]->backpropogate(layers[i + 1]->getGradInputPtr());
-					}
+						// Calculate loss and gradients for the batch, in shards across replicas if parallel
+						float batchLoss;
+						if (isPipelined) batchLoss = computeGradientsPipelined(replicas, shards, *pipeline, inputBatch, expectedBatch, lossFn, fuseSoftmaxLoss);
+						else if (threadCount == 1) batchLoss = computeGradients(&inputBatch, expectedBatch, lossFn, fuseSoftmaxLoss);
+						else batchLoss = computeGradientsParallel(replicas, shards, inputBatch, expectedBatch, lossFn, fuseSoftmaxLoss);
+						epochLoss += batchLoss / maxBatch;
+						sampleCount += inputBatch.getShape(0);
 
-					// Apply gradient descent
-					for (size_t j = 0; j < layers.size(); j++)
-					{
-						layers[j]->gradientDescent(config.learningRate, config.momentumRate);
-					}
+						// Update parameters from the batch gradient
+						applyOptimizer(*optimizers[0], parameters);
 
-					if (config.logLevel >= 3)
-					{
-						if ((batch + 1) % config.logFrequency == 0)
+						if (config.logLevel >= 3)
 						{
-							std::chrono::steady_clock::time_point tBatchEnd = std::chrono::steady_clock::now();
-							auto us = std::chrono::duration_cast<std::chrono::microseconds>(tBatchEnd - tBatchStart);
-							printf("Epoch [%zd / %zd], Batch [%zd / %zd]: Loss: %.3f, Time: %.3fms\n", epoch + 1, maxEpoch, batch + 1, maxBatch, batchLoss, us.count() / 1000.0f);
-							tBatchStart = tBatchEnd;
+							if ((batch + 1) % config.logFrequency == 0)
+							{
+								std::chrono::steady_clock::time_point tBatchEnd = std::chrono::steady_clock::now();
+								auto us = std::chrono::duration_cast<std::chrono::microseconds>(tBatchEnd - tBatchStart);
+								printf("Epoch [%zd / %zd], Batch [%zd / %zd]: Loss: %.3f, Time: %.3fms\n", epoch + 1, maxEpoch, batch + 1, maxBatch, batchLoss, us.count() / 1000.0f);
+								tBatchStart = tBatchEnd;
+							}
 						}
 					}
 				}
@@ -495,16 +1519,104 @@ namespace tbml
 					tBatchStart = tEpochEnd;
 				}
 
-				// Exit if error threshold is met
+				// Exit if error threshold is met or the callback stops training
 				if (epochLoss < config.errorThreshold) break;
+				if (config.epochCallback != nullptr && !config.epochCallback(epoch, epochLoss)) break;
 			}
 
 			if (config.logLevel >= 1)
 			{
 				std::chrono::steady_clock::time_point tTrainEnd = std::chrono::steady_clock::now();
 				auto us = std::chrono::duration_cast<std::chrono::microseconds>(tTrainEnd - tTrainStart);
-				printf("Training complete for %zd epochs, Time taken: %.3fms\n\n", epoch, us.count() / 1000.0f);
+				printf("Training complete for %zd epochs, Time taken: %.3fms\n", epoch, us.count() / 1000.0f);
+				if (isCheckpointed)
+				{
+					// Layers up to each checkpoint are propogated twice, parameters are the FLOP proxy as in partitionStages
+					size_t recomputedParameters = 0;
+					for (size_t k = 0; k + 2 < segmentBounds.size(); k++)
+					{
+						for (size_t i = segmentBounds[k]; i < getRecomputeEnd(k); i++) recomputedParameters += layers[i]->getParameterCount();
+					}
+					printf("Checkpointing: %zd segments, %.1fKB arena vs %.1fKB keeping every output, %.1f%% of forward FLOPs recomputed\n",
+						segmentBounds.size() - 1, memoryPlan->getArenaSize() * sizeof(float) / 1024.0f, fullArenaSize * sizeof(float) / 1024.0f,
+						100.0f * recomputedParameters / std::max(getParameterCount(), (size_t)1));
+				}
+				if (profiler != nullptr) profiler->print();
+				float samplesPerSecond = sampleCount / (us.count() / 1'000'000.0f);
+				if (isPipelined) printf("Throughput: %.1f samples/s, %zd stages, %zd micro-batches, pipelined\n\n", samplesPerSecond, pipeline->getStageCount(), threadCount);
+				else printf("Throughput: %.1f samples/s, %zd threads, %s\n\n", samplesPerSecond, threadCount, isAsync ? "asynchronous" : "synchronous");
+			}
+
+			clearMemoryPlan();
+			profiler = nullptr;
+		}
+
+		NeuralNetwork NeuralNetwork::clone() const
+		{
+			// Layer parameters are copy-on-write so this is O(layers)
+			std::vector<Layer::BasePtr> clonedLayers;
+			for (const auto& layer : layers) clonedLayers.push_back(layer->clone());
+			return NeuralNetwork(std::move(clonedLayers));
+		}
+
+		std::vector<Parameter> NeuralNetwork::getParameters()
+		{
+			std::vector<Parameter> parameters;
+			for (size_t i = 0; i < layers.size(); i++)
+			{
+				size_t first = parameters.size();
+				layers[i]->getParameters(parameters);
+				for (size_t j = first; j < parameters.size(); j++) parameters[j].layer = i;
+			}
+			return parameters;
+		}
+
+		float NeuralNetwork::pruneBelow(float threshold)
+		{
+			for (const auto& layer : layers)
+			{
+				Layer::Dense* dense = dynamic_cast<Layer::Dense*>(layer.get());
+				if (dense != nullptr) dense->pruneBelow(threshold);
+			}
+			return getSparsity();
+		}
+
+		float NeuralNetwork::pruneTopK(size_t k)
+		{
+			for (const auto& layer : layers)
+			{
+				Layer::Dense* dense = dynamic_cast<Layer::Dense*>(layer.get());
+				if (dense != nullptr) dense->pruneTopK(k);
+			}
+			return getSparsity();
+		}
+
+		float NeuralNetwork::pruneToSparsity(float sparsity)
+		{
+			// Per output rather than one global threshold so no output loses all of its inputs
+			for (const auto& layer : layers)
+			{
+				Layer::Dense* dense = dynamic_cast<Layer::Dense*>(layer.get());
+				if (dense == nullptr) continue;
+				size_t inputSize = dense->getWeights().getShape(0);
+				dense->pruneTopK((size_t)std::lround((1.0f - sparsity) * inputSize));
+			}
+			return getSparsity();
+		}
+
+		float NeuralNetwork::getSparsity() const
+		{
+			size_t total = 0;
+			float zeros = 0.0f;
+			for (const auto& layer : layers)
+			{
+				const Layer::Dense* dense = dynamic_cast<const Layer::Dense*>(layer.get());
+				if (dense == nullptr) continue;
+				size_t size = dense->getWeights().getSize();
+				zeros += dense->getSparsity() * size;
+				total += size;
 			}
+			return total > 0 ? zeros / total : 0.0f;
 		}
 
 		size_t NeuralNetwork::getParameterCount() const
@@ -1,7 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include "Utility.h"
 #include "Tensor.h"
+#include "MemoryPlan.h"
+#include "InferenceModel.h"
+#include "BoundedQueue.h"
+#include "Optimizer.h"
+#include "Profiler.h"
 
 namespace tbml
 {
@@ -22,8 +29,28 @@ namespace tbml
 				virtual void propogateMut(Tensor& input) const = 0;
 				virtual const Tensor* propogatePtr(const Tensor* input) = 0;
 				virtual void backpropogate(const Tensor* gradOutput) = 0;
-				virtual void gradientDescent(float learningRate, float momentumRate) {};
 				virtual std::shared_ptr<Base> clone() const = 0;
+				virtual std::string getName() const = 0;
+
+				// FLOPs of the last propogatePtr / backpropogate, multiply-adds counting 2
+				virtual double getForwardFlops() const { return 0.0; }
+				virtual double getBackwardFlops() const { return 0.0; }
+
+				// Append trainable parameters with their gradients, always in the same order
+				virtual void getParameters(std::vector<Parameter>& /* parameters */) {}
+
+				// Called once an optimizer has updated the parameters
+				virtual void onParametersUpdated() {}
+
+				// Data parallel replicas read source's parameters, nullptr releases them
+				virtual void shareParameters(const Base* /* source */) {}
+
+				// gradients = scale * gradients + otherScale * other's gradients, other can be nullptr
+				virtual void reduceGradients(const Base* /* other */, float /* otherScale */, float /* scale */) {}
+
+				// Asynchronous replicas read and update source's parameters in place, nullptr releases them
+				virtual void bindParameters(Base* /* source */) {}
+
 				virtual void print() const {}
 				virtual void serialize(std::ostream& os) const = 0;
 				virtual std::vector<size_t> getInputShape() const = 0;
@@ -32,6 +59,10 @@ namespace tbml
 				const Tensor* getOutputPtr() const { return &output; };
 				const Tensor* getGradInputPtr() const { return &gradInput; };
 
+				// Place output or gradInput in planned memory, nullptr returns them to owned storage
+				void bindOutput(float* memory, size_t capacity) { if (memory != nullptr) output.bindView(memory, capacity); else output.unbindView(); }
+				void bindGradInput(float* memory, size_t capacity) { if (memory != nullptr) gradInput.bindView(memory, capacity); else gradInput.unbindView(); }
+
 			protected:
 				Tensor output;
 				Tensor gradInput;
@@ -51,104 +82,177 @@ namespace tbml
 
 				virtual void propogateMut(Tensor& input) const override;
 				virtual const Tensor* propogatePtr(const Tensor* input) override;
+				void propogateMut(Tensor& input, backend::Activation fn) const;
+				void propogateInto(const Tensor* input, backend::Activation fn, Tensor& destination);
 				void backpropogate(const Tensor* gradOutput) override;
-				void gradientDescent(float learningRate, float momentumRate) override;
+				void getParameters(std::vector<Parameter>& parameters) override;
+				void onParametersUpdated() override;
 				virtual void print() const override;
 				virtual BasePtr clone() const override;
+				std::string getName() const override { return "Dense"; }
+				double getForwardFlops() const override;
+				double getBackwardFlops() const override;
+				void shareParameters(const Base* source) override;
+				void reduceGradients(const Base* other, float otherScale, float scale) override;
+				void bindParameters(Base* source) override;
 				std::vector<size_t> getInputShape() const override { return { weights.getShape(0) }; }
 				std::vector<size_t> getOutputShape() const override { return { weights.getShape(1) }; }
 				size_t getParameterCount() const override { return weights.getSize() + bias.getSize(); }
 				const Tensor& getWeights() const { return weights; }
 				const Tensor& getBias() const { return bias; }
+				const Tensor& getGradWeights() const { return gradWeights; }
+				const Tensor& getGradBias() const { return gradBias; }
 				virtual void serialize(std::ostream& os) const override;
+				const PackedMatrix& getPackedWeights() const;
+
+				// Compressed weights if sparse enough for the sparse kernel to be faster on batches, otherwise nullptr
+				const SparseMatrix* getSparseWeights() const;
+
+				// Magnitude pruning, zeroes weights below threshold or all but the k largest feeding each output
+				// Pruned weights are masked so they stay zero through later training
+				void pruneBelow(float threshold);
+				void pruneTopK(size_t k);
+				float getSparsity() const;
 
 			private:
 				Tensor weights;
 				Tensor bias;
 				Tensor gradWeights;
 				Tensor gradBias;
-				Tensor momentumWeights;
-				Tensor momentumBias;
+
+				// 1 for kept and 0 for pruned weights, empty if never pruned
+				Tensor mask;
+
+				// Weights packed for matmul, built lazily and invalidated by onParametersUpdated
+				mutable PackedMatrix packedWeights;
+				mutable std::atomic<bool> isPackedValid = false;
+				mutable SparseMatrix sparseWeights;
+				mutable std::atomic<bool> isSparseValid = false;
+				mutable std::mutex packMutex;
+
+				void setMask(std::vector<float>&& maskValues);
 			};
 
-			class ReLU : public Base
+			// 2D convolution of rows holding (channels x height x width) images, output rows hold (filters x outHeight x outWidth)
+			// Lowered to im2col of the whole batch then one GEMM with weights (patch size x filters), see backend::Base::im2col
+			class Conv2D : public Base
 			{
 			public:
+				// Rows propogateMut lowers at once, bounding its im2col scratch to this many rows' patches
+				static constexpr size_t PROPOGATE_ROW_BLOCK = 64;
+
+				Conv2D(const Conv2D& other);
+				Conv2D(const backend::ConvShape& conv, size_t filters, Dense::InitType initType = Dense::InitType::RANDOM, bool useBias = true);
+				Conv2D(const backend::ConvShape& conv, Tensor&& weights, Tensor&& bias);
+
 				virtual void propogateMut(Tensor& input) const override;
 				virtual const Tensor* propogatePtr(const Tensor* input) override;
 				void backpropogate(const Tensor* gradOutput) override;
+				void getParameters(std::vector<Parameter>& parameters) override;
+				void onParametersUpdated() override;
+				virtual void print() const override;
 				virtual BasePtr clone() const override;
-				std::vector<size_t> getInputShape() const override { return { 1 }; }
-				std::vector<size_t> getOutputShape() const override { return { 1 }; }
+				std::string getName() const override { return "Conv2D"; }
+				double getForwardFlops() const override;
+				double getBackwardFlops() const override;
+				void shareParameters(const Base* source) override;
+				void reduceGradients(const Base* other, float otherScale, float scale) override;
+				void bindParameters(Base* source) override;
+				std::vector<size_t> getInputShape() const override { return { conv.getInputSize() }; }
+				std::vector<size_t> getOutputShape() const override { return { weights.getShape(1) * conv.getOutHeight() * conv.getOutWidth() }; }
+				size_t getParameterCount() const override { return weights.getSize() + bias.getSize(); }
+				const backend::ConvShape& getConvShape() const { return conv; }
+				const Tensor& getWeights() const { return weights; }
+				const Tensor& getBias() const { return bias; }
+				const Tensor& getGradWeights() const { return gradWeights; }
+				const Tensor& getGradBias() const { return gradBias; }
 				virtual void serialize(std::ostream& os) const override;
+				const PackedMatrix& getPackedWeights() const;
+
+			private:
+				backend::ConvShape conv;
+				Tensor weights;
+				Tensor bias;
+				Tensor gradWeights;
+				Tensor gradBias;
+
+				// im2col of the last input and the GEMM operands of backprop, kept so later batches reuse their storage
+				Tensor columns;
+				Tensor gradColumns;
+				Tensor gradRows;
+
+				// Weights packed for matmul, built lazily and invalidated by onParametersUpdated
+				mutable PackedMatrix packedWeights;
+				mutable std::atomic<bool> isPackedValid = false;
+				mutable std::mutex packMutex;
+
+				void propogateColumns(const Tensor& patches, Tensor& destination) const;
 			};
 
-			class Sigmoid : public Base
+			// Elementwise activation, NeuralNetwork fuses these into a preceding Dense
+			// Backpropogates from its output so the fused pre-activation is never needed
+			class Activation : public Base
 			{
 			public:
+				Activation(backend::Activation fn) : fn(fn) {}
 				virtual void propogateMut(Tensor& input) const override;
 				virtual const Tensor* propogatePtr(const Tensor* input) override;
+				const Tensor* propogateFused(const Tensor* input, Dense& dense);
 				void backpropogate(const Tensor* gradOutput) override;
-				virtual BasePtr clone() const override;
+				double getForwardFlops() const override { return (double)output.getSize(); }
+				double getBackwardFlops() const override { return 2.0 * output.getSize(); }
 				std::vector<size_t> getInputShape() const override { return { 1 }; }
 				std::vector<size_t> getOutputShape() const override { return { 1 }; }
-				virtual void serialize(std::ostream& os) const override;
+				backend::Activation getFunction() const { return fn; }
 
 			private:
-				float sigmoid(float x) const { return 1.0f / (1.0f + std::exp(-x)); }
+				const backend::Activation fn;
 			};
 
-			class TanH : public Base
+			class ReLU : public Activation
 			{
 			public:
-				virtual void propogateMut(Tensor& input) const override;
-				virtual const Tensor* propogatePtr(const Tensor* input) override;
-				void backpropogate(const Tensor* gradOutput) override;
+				ReLU() : Activation(backend::Activation::ReLU) {}
 				virtual BasePtr clone() const override;
-				std::vector<size_t> getInputShape() const override { return { 1 }; }
-				std::vector<size_t> getOutputShape() const override { return { 1 }; }
+				std::string getName() const override { return "ReLU"; }
 				virtual void serialize(std::ostream& os) const override;
 			};
 
-			class Softmax : public Base
+			class Sigmoid : public Activation
 			{
 			public:
-				virtual void propogateMut(Tensor& input) const override;
-				virtual const Tensor* propogatePtr(const Tensor* input) override;
-				void backpropogate(const Tensor* gradOutput) override;
+				Sigmoid() : Activation(backend::Activation::Sigmoid) {}
 				virtual BasePtr clone() const override;
-				std::vector<size_t> getInputShape() const override { return { 1 }; }
-				std::vector<size_t> getOutputShape() const override { return { 1 }; }
+				std::string getName() const override { return "Sigmoid"; }
 				virtual void serialize(std::ostream& os) const override;
 			};
 
-			/*
-			class ConvLayer : public Layer
+			class TanH : public Activation
 			{
 			public:
-				ConvLayer(std::vector<size_t> kernel, std::vector<size_t> stride, fn::ActivationFunction&& activationFn);
-				virtual const Tensor& propogate(const Tensor& input) override;
-				virtual Tensor propogate(const Tensor& input) const override;
-				virtual void propogate(Tensor& input) const override;
-				virtual void backpropogate(const Tensor& gradOutput) override;
-				virtual void gradientDescent(float learningRate, float momentumRate) override;
-				virtual LayerPtr clone() const override;
-
-			private:
-				fn::ActivationFunction activationFn;
+				TanH() : Activation(backend::Activation::TanH) {}
+				virtual BasePtr clone() const override;
+				std::string getName() const override { return "TanH"; }
+				virtual void serialize(std::ostream& os) const override;
 			};
 
-			class FlattenLayer : public Layer
+			class Softmax : public Base
 			{
 			public:
-				FlattenLayer();
-				virtual const Tensor& propogate(const Tensor& input) override;
-				virtual Tensor propogate(const Tensor& input) const override;
-				virtual void propogate(Tensor& input) const override;
-				virtual void backpropogate(const Tensor& gradOutput) override;
-				virtual LayerPtr clone() const override;
+				virtual void propogateMut(Tensor& input) const override;
+				virtual const Tensor* propogatePtr(const Tensor* input) override;
+				void backpropogate(const Tensor* gradOutput) override;
+				float backpropogateCrossEntropy(const Tensor& expected);
+				virtual BasePtr clone() const override;
+				std::string getName() const override { return "Softmax"; }
+				double getForwardFlops() const override { return 4.0 * output.getSize(); }
+				double getBackwardFlops() const override { return 4.0 * output.getSize(); }
+				std::vector<size_t> getInputShape() const override { return { 1 }; }
+				std::vector<size_t> getOutputShape() const override { return { 1 }; }
+				virtual void serialize(std::ostream& os) const override;
 			};
 
+			/*
 			class MaxPoolLayer : public Layer
 			{
 			public:
@@ -173,6 +277,39 @@ namespace tbml
 			float errorThreshold = 0.0f;
 			size_t logLevel = 0;
 			size_t logFrequency = 1;
+
+			// Replicas each training a shard of every batch, -1 for one per core
+			int threadCount = 1;
+
+			// With threadCount > 1 replicas instead pull whole batches and update shared weights lock free
+			bool asynchronous = false;
+
+			// Layer groups run as a pipeline on this many threads, each batch split into micro-batches
+			int pipelineStages = 1;
+			int microBatchCount = 4;
+
+			// Cloned for each training run, nullptr uses SGD with learningRate and momentumRate
+			OptimizerPtr optimizer;
+
+			// Reset then filled with per layer, TensorBatcher and Loss times if set, printed at the end if logging
+			// In parallel modes only this network's share of the work is timed
+			ProfilerPtr profiler;
+
+			// Keep only these layers' outputs through the forward pass, the rest are recomputed during backprop
+			// If empty a checkpointInterval > 0 keeps every checkpointInterval layers, -1 every sqrt(layers)
+			std::vector<size_t> checkpointLayers;
+			int checkpointInterval = 0;
+
+			// Called after each epoch with its average loss, returning false stops training as errorThreshold does
+			std::function<bool(size_t epoch, float loss)> epochCallback;
+		};
+
+		// Metrics over a whole dataset from NeuralNetwork::evaluate
+		struct Evaluation
+		{
+			size_t rows = 0;
+			float loss = 0.0f;
+			float accuracy = 0.0f;
 		};
 
 		class TensorBatcher
@@ -184,6 +321,7 @@ namespace tbml
 			const Tensor& getBatchInput(size_t batchIndex) const { return inputBatches[batchIndex]; }
 			const Tensor& getBatchExpected(size_t batchIndex) const { return expectedBatches[batchIndex]; }
 			size_t getBatchCount() const { return batchCount; }
+			size_t getBatchSize() const { return batchSize; }
 
 		private:
 			const Tensor& input;
@@ -191,6 +329,7 @@ namespace tbml
 			size_t batchSize;
 			size_t batchCount;
 			std::vector<int> indices;
+			std::vector<size_t> batchIndices;
 			std::vector<Tensor> inputBatches;
 			std::vector<Tensor> expectedBatches;
 		};
@@ -207,16 +346,77 @@ namespace tbml
 			virtual Tensor propogate(const Tensor& input) const;
 			virtual void propogateMut(Tensor& input) const;
 			virtual const Tensor* propogatePtr(const Tensor* input);
+			Tensor propogatePipelined(const Tensor& input, size_t stageCount, size_t microBatchSize) const;
+
+			// Loss and classification accuracy over the dataset in chunks of rows on threadCount threads, -1 for one per core
+			// Memory use depends on chunkSize not dataset size, lossFn can be nullptr to only measure accuracy
+			Evaluation evaluate(const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, size_t chunkSize = 1024, int threadCount = -1) const;
 			void train(const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr lossFn, const TrainingConfig& config);
+			void planMemory(const std::vector<size_t>& inputShape, const std::vector<size_t>& checkpointLayers = {});
+			void clearMemoryPlan();
+			InferenceModel compileForInference() const;
+			const MemoryPlan* getMemoryPlan() const { return memoryPlan.get(); }
+			NeuralNetwork clone() const;
 			void print() const;
 			void saveToFile(const std::string& filename) const;
 			std::vector<size_t> getInputShape() const { return layers[0]->getInputShape(); }
 			std::vector<size_t> getOutputShape() const { return layers[layers.size() - 1]->getOutputShape(); }
 			const std::vector<Layer::BasePtr>& getLayers() const { return layers; }
 			size_t getParameterCount() const;
+			std::vector<Parameter> getParameters();
+
+			// Prune every Dense layer, see Layer::Dense::pruneBelow, returns the fraction of Dense weights now zero
+			// pruneToSparsity keeps the largest (1 - sparsity) of the weights feeding each output
+			float pruneBelow(float threshold);
+			float pruneTopK(size_t k);
+			float pruneToSparsity(float sparsity);
+			float getSparsity() const;
 
 		private:
+			// Rows of a batch given to one data parallel replica
+			struct Shard
+			{
+				Tensor input;
+				Tensor expected;
+				std::vector<size_t> indices;
+				float loss = 0.0f;
+			};
+
+			// Layers [stageBounds[s], stageBounds[s + 1]) run on stage s, queues pass micro-batch indices between stages
+			struct Pipeline
+			{
+				std::vector<size_t> stageBounds;
+				std::vector<std::unique_ptr<BoundedQueue<size_t>>> forwardQueues;
+				std::vector<std::unique_ptr<BoundedQueue<size_t>>> backwardQueues;
+
+				Pipeline(std::vector<size_t>&& stageBounds, size_t backwardCapacity);
+				size_t getStageCount() const { return stageBounds.size() - 1; }
+			};
+
 			std::vector<Layer::BasePtr> layers;
+			std::shared_ptr<MemoryPlan> memoryPlan;
+			ProfilerPtr profiler;
+
+			// Gradient of the loss to the last layer's output when not fused into a Softmax
+			Tensor gradLoss;
+
+			// Layers [segmentBounds[k], segmentBounds[k + 1]) are recomputed from the checkpoint before them in backprop
+			// Empty or a single segment keeps every output
+			std::vector<size_t> segmentBounds;
+
+			void propogateMutRange(Tensor& input, size_t first, size_t last) const;
+			const Tensor* propogateRange(const Tensor* input, size_t first, size_t last);
+			void backpropogateLayers(size_t first, size_t last);
+			float backpropogateLoss(const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss);
+			std::vector<size_t> partitionStages(size_t stageCount) const;
+			std::vector<size_t> partitionSegments(const std::vector<size_t>& checkpointLayers) const;
+			size_t getRecomputeEnd(size_t segment) const;
+			float computeGradients(const Tensor* input, const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss);
+			void applyOptimizer(Optimizer& optimizer, const std::vector<Parameter>& parameters);
+			float trainEpochAsync(std::vector<NeuralNetwork>& replicas, std::vector<OptimizerPtr>& optimizers, const TensorBatcher& batcher, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss);
+			float computeGradientsPipelined(std::vector<NeuralNetwork>& replicas, std::vector<Shard>& microBatches, Pipeline& pipeline, const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss);
+			float computeGradientsParallel(std::vector<NeuralNetwork>& replicas, std::vector<Shard>& shards, const Tensor& input, const Tensor& expected, const tbml::fn::LossFunctionPtr& lossFn, bool fuseSoftmaxLoss);
+			bool getFusedPair(size_t i, Layer::Dense*& dense, Layer::Activation*& activation) const;
 		};
 
 		NeuralNetwork loadFromFile(const std::string& filename);
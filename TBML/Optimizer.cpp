@@ -0,0 +1,62 @@
+#include "stdafx.h"
+#include "Optimizer.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		void Optimizer::step(const std::vector<Parameter>& parameters, Profiler* profiler)
+		{
+			// Reallocate state if the parameters are not those of the last step
+			bool isSame = parameters.size() == parameterSizes.size();
+			for (size_t i = 0; isSame && i < parameters.size(); i++) isSame = parameters[i].value->getSize() == parameterSizes[i];
+			if (!isSame) allocateState(parameters);
+
+			t++;
+			size_t stateCount = getStateCount();
+			for (size_t i = 0; i < parameters.size(); i++)
+			{
+				Profiler::Clock::time_point start = profiler != nullptr ? Profiler::Clock::now() : Profiler::Clock::time_point();
+				update(parameters[i], &state[i * stateCount], t);
+				if (profiler != nullptr) profiler->add(parameters[i].layer, Profiler::Phase::Optimizer, start);
+			}
+		}
+
+		void Optimizer::allocateState(const std::vector<Parameter>& parameters)
+		{
+			// Every state tensor is a view into one zeroed arena, so state starts at zero and never allocates again
+			size_t stateCount = getStateCount();
+			size_t total = 0;
+			parameterSizes.clear();
+			for (const auto& parameter : parameters)
+			{
+				parameterSizes.push_back(parameter.value->getSize());
+				total += parameter.value->getSize();
+			}
+
+			arena.assign(total * stateCount, 0.0f);
+			state.clear();
+			state.resize(parameters.size() * stateCount);
+			size_t offset = 0;
+			for (size_t i = 0; i < parameters.size(); i++)
+			{
+				for (size_t j = 0; j < stateCount; j++)
+				{
+					state[i * stateCount + j].bindView(arena.data() + offset, parameterSizes[i]);
+					offset += parameterSizes[i];
+				}
+			}
+			t = 0;
+		}
+
+		void SGD::update(const Parameter& parameter, Tensor* state, size_t /* t */)
+		{
+			parameter.value->sgdMomentumStep(*parameter.grad, state[0], learningRate, momentumRate);
+		}
+
+		void Adam::update(const Parameter& parameter, Tensor* state, size_t t)
+		{
+			parameter.value->adamStep(*parameter.grad, state[0], state[1], learningRate, beta1, beta2, epsilon, getWeightDecay(), t);
+		}
+	}
+}
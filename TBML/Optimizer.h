@@ -0,0 +1,103 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "Tensor.h"
+#include "Profiler.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		// A layer's parameter and the gradient an optimizer updates it from
+		// layer is the owning layer's index, set by NeuralNetwork::getParameters
+		struct Parameter
+		{
+			Tensor* value;
+			const Tensor* grad;
+			size_t layer = 0;
+		};
+
+		// Updates parameters from their gradients with one fused kernel per parameter
+		// Per parameter state such as momentum lives in one flat zeroed arena, allocated on the first step
+		class Optimizer
+		{
+		public:
+			virtual ~Optimizer() = default;
+
+			// Update time is added to each parameter's layer record if profiled
+			void step(const std::vector<Parameter>& parameters, Profiler* profiler = nullptr);
+
+			// Same hyperparameters with fresh state
+			virtual std::shared_ptr<Optimizer> clone() const = 0;
+			virtual std::string getName() const = 0;
+
+		protected:
+			// State tensors used per parameter, e.g. 1 for momentum
+			virtual size_t getStateCount() const = 0;
+			virtual void update(const Parameter& parameter, Tensor* state, size_t t) = 0;
+
+		private:
+			std::vector<float> arena;
+			std::vector<Tensor> state;
+			std::vector<size_t> parameterSizes;
+			size_t t = 0;
+
+			void allocateState(const std::vector<Parameter>& parameters);
+		};
+
+		using OptimizerPtr = std::shared_ptr<Optimizer>;
+
+		class SGD : public Optimizer
+		{
+		public:
+			SGD(float learningRate, float momentumRate = 0.0f) : learningRate(learningRate), momentumRate(momentumRate) {}
+			OptimizerPtr clone() const override { return std::make_shared<SGD>(learningRate, momentumRate); }
+			std::string getName() const override { return "SGD"; }
+
+		protected:
+			size_t getStateCount() const override { return 1; }
+			void update(const Parameter& parameter, Tensor* state, size_t t) override;
+
+		private:
+			const float learningRate;
+			const float momentumRate;
+		};
+
+		class Adam : public Optimizer
+		{
+		public:
+			Adam(float learningRate = 0.001f, float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1e-8f)
+				: learningRate(learningRate), beta1(beta1), beta2(beta2), epsilon(epsilon) {}
+			OptimizerPtr clone() const override { return std::make_shared<Adam>(learningRate, beta1, beta2, epsilon); }
+			std::string getName() const override { return "Adam"; }
+
+		protected:
+			size_t getStateCount() const override { return 2; }
+			void update(const Parameter& parameter, Tensor* state, size_t t) override;
+			virtual float getWeightDecay() const { return 0.0f; }
+
+			const float learningRate;
+			const float beta1;
+			const float beta2;
+			const float epsilon;
+		};
+
+		// Adam with weight decay applied to the parameters directly rather than through the gradient
+		class AdamW : public Adam
+		{
+		public:
+			AdamW(float learningRate = 0.001f, float weightDecay = 0.01f, float beta1 = 0.9f, float beta2 = 0.999f, float epsilon = 1e-8f)
+				: Adam(learningRate, beta1, beta2, epsilon), weightDecay(weightDecay) {}
+			OptimizerPtr clone() const override { return std::make_shared<AdamW>(learningRate, weightDecay, beta1, beta2, epsilon); }
+			std::string getName() const override { return "AdamW"; }
+
+		protected:
+			float getWeightDecay() const override { return weightDecay; }
+
+		private:
+			const float weightDecay;
+		};
+	}
+}
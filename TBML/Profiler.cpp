@@ -0,0 +1,68 @@
+#include "stdafx.h"
+#include "Profiler.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		double Profiler::Record::getTotalSeconds() const
+		{
+			double total = 0.0;
+			for (double phaseSeconds : seconds) total += phaseSeconds;
+			return total;
+		}
+
+		double Profiler::Record::getGFlops() const
+		{
+			double computeSeconds = getSeconds(Phase::Forward) + getSeconds(Phase::Backward);
+			return computeSeconds > 0.0 ? flops / computeSeconds / 1e9 : 0.0;
+		}
+
+		void Profiler::reset(std::vector<std::string>&& names)
+		{
+			records.clear();
+			records.resize(names.size());
+			for (size_t i = 0; i < names.size(); i++) records[i].name = std::move(names[i]);
+		}
+
+		void Profiler::add(size_t record, Phase phase, Clock::time_point start, double flops)
+		{
+			std::chrono::duration<double> elapsed = Clock::now() - start;
+			records[record].seconds[(size_t)phase] += elapsed.count();
+			records[record].flops += flops;
+		}
+
+		const Profiler::Record* Profiler::getRecord(const std::string& name) const
+		{
+			for (const Record& record : records)
+			{
+				if (record.name == name) return &record;
+			}
+			return nullptr;
+		}
+
+		double Profiler::getTotalSeconds() const
+		{
+			double total = 0.0;
+			for (const Record& record : records) total += record.getTotalSeconds();
+			return total;
+		}
+
+		void Profiler::print() const
+		{
+			std::vector<const Record*> sorted;
+			for (const Record& record : records) sorted.push_back(&record);
+			std::stable_sort(sorted.begin(), sorted.end(), [](const Record* a, const Record* b) { return a->getTotalSeconds() > b->getTotalSeconds(); });
+
+			double total = getTotalSeconds();
+			printf("%-28s %12s %12s %12s %12s %12s %7s %9s\n", "Record", "Forward ms", "Backward ms", "Optimizer ms", "Other ms", "Total ms", "Share", "GFLOP/s");
+			for (const Record* record : sorted)
+			{
+				printf("%-28s %12.3f %12.3f %12.3f %12.3f %12.3f %6.1f%% %9.2f\n", record->name.c_str(),
+					record->getSeconds(Phase::Forward) * 1000.0, record->getSeconds(Phase::Backward) * 1000.0,
+					record->getSeconds(Phase::Optimizer) * 1000.0, record->getSeconds(Phase::Other) * 1000.0,
+					record->getTotalSeconds() * 1000.0, total > 0.0 ? 100.0 * record->getTotalSeconds() / total : 0.0, record->getGFlops());
+			}
+		}
+	}
+}
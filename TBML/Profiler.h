@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tbml
+{
+	namespace nn
+	{
+		// Accumulates time and FLOPs per record, NeuralNetwork::train keeps one per layer then TensorBatcher and Loss
+		// Records can be added to from different threads, but each record from only one at a time
+		class Profiler
+		{
+		public:
+			using Clock = std::chrono::steady_clock;
+			enum class Phase { Forward, Backward, Optimizer, Other };
+			static const size_t PHASE_COUNT = 4;
+
+			struct Record
+			{
+				std::string name;
+				double seconds[PHASE_COUNT] = {};
+				double flops = 0.0;
+
+				double getSeconds(Phase phase) const { return seconds[(size_t)phase]; }
+				double getTotalSeconds() const;
+
+				// Achieved over forward and backward, the phases FLOPs are counted for
+				double getGFlops() const;
+			};
+
+			// Clear everything and start again with these records
+			void reset(std::vector<std::string>&& names);
+
+			// Add the time since start to a record
+			void add(size_t record, Phase phase, Clock::time_point start, double flops = 0.0);
+
+			const std::vector<Record>& getRecords() const { return records; }
+			const Record* getRecord(const std::string& name) const;
+			double getTotalSeconds() const;
+
+			// Table of records sorted by total time
+			void print() const;
+
+		private:
+			std::vector<Record> records;
+		};
+
+		using ProfilerPtr = std::shared_ptr<Profiler>;
+	}
+}
@@ -0,0 +1,149 @@
+#include "stdafx.h"
+#include "Sweep.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "omp.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		Sweep::Sweep(const Tensor& input, const Tensor& expected, const Tensor& validationInput, const Tensor& validationExpected)
+			: input(input), expected(expected), validationInput(validationInput), validationExpected(validationExpected)
+		{}
+
+		std::vector<SweepResult> Sweep::run(const NetworkFactory& makeNetwork, const std::vector<TrainingConfig>& configs, const tbml::fn::LossFunctionPtr& lossFn, const SweepConfig& sweepConfig)
+		{
+			trace::Scope scope("sweep");
+			epochLosses.clear();
+			if (configs.empty()) return {};
+
+			// Split the cores evenly, each job's kernels and evaluation use only its share
+			size_t cores = sweepConfig.threadCount == -1 ? (size_t)omp_get_num_procs() : (size_t)std::max(sweepConfig.threadCount, 1);
+			size_t concurrentJobs = sweepConfig.concurrentJobs == 0 ? cores : sweepConfig.concurrentJobs;
+			concurrentJobs = std::min(concurrentJobs, configs.size());
+			int jobThreads = (int)std::max(cores / concurrentJobs, (size_t)1);
+			if (sweepConfig.logLevel > 0) printf("Sweep started for %zd jobs, %zd at once with %d threads each\n", configs.size(), concurrentJobs, jobThreads);
+
+			// Jobs are queued in order so early ones set the medians later ones are compared against
+			std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+			std::vector<SweepResult> results(configs.size());
+			{
+				ThreadPool pool(concurrentJobs);
+				std::vector<std::future<SweepResult>> futures;
+				for (size_t job = 0; job < configs.size(); job++)
+				{
+					futures.push_back(pool.enqueue([&, job] { return runJob(job, makeNetwork, configs[job], lossFn, sweepConfig, jobThreads); }));
+				}
+				for (size_t job = 0; job < configs.size(); job++) results[job] = futures[job].get();
+			}
+
+			if (sweepConfig.logLevel > 0)
+			{
+				auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tStart);
+				size_t killed = 0;
+				size_t epochs = 0;
+				for (const SweepResult& result : results)
+				{
+					killed += result.killed ? 1 : 0;
+					epochs += result.epochs;
+				}
+				printf("Sweep complete for %zd jobs, %zd killed early, %zd epochs trained, Time taken: %.3fms\n", results.size(), killed, epochs, us.count() / 1000.0f);
+				printTable(results);
+			}
+			return results;
+		}
+
+		SweepResult Sweep::runJob(size_t job, const NetworkFactory& makeNetwork, const TrainingConfig& config, const tbml::fn::LossFunctionPtr& lossFn, const SweepConfig& sweepConfig, int jobThreads)
+		{
+			// Backend kernels size their teams from omp_get_max_threads, so this gives them the job's share of the cores
+			// Counts passed to num_threads explicitly, replicas and evaluation, are capped to the share below
+			trace::Scope scope("sweep job", "job", job);
+			omp_set_num_threads(jobThreads);
+			std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+			SweepResult result;
+			result.job = job;
+			result.config = config;
+			float bestLoss = std::numeric_limits<float>::infinity();
+			TrainingConfig jobConfig = config;
+
+			// Replica counts are passed to num_threads explicitly so are capped to the share too, -1 meaning all of it
+			jobConfig.threadCount = config.threadCount == -1 ? jobThreads : std::min(config.threadCount, jobThreads);
+			jobConfig.epochCallback = [&](size_t epoch, float loss)
+			{
+				result.epochs = epoch + 1;
+				result.trainLoss = loss;
+				bestLoss = std::min(bestLoss, loss);
+				result.killed = !report(epoch, loss, bestLoss, sweepConfig);
+				return !result.killed && (config.epochCallback == nullptr || config.epochCallback(epoch, loss));
+			};
+
+			NeuralNetwork network = makeNetwork();
+			network.train(input, expected, lossFn, jobConfig);
+			if (!result.killed) result.validation = network.evaluate(validationInput, validationExpected, lossFn, 1024, jobThreads);
+			result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+			if (sweepConfig.logLevel >= 2)
+			{
+				if (result.killed) printf("Job %zd: killed at epoch %zd, Loss: %.3f\n", job, result.epochs, result.trainLoss);
+				else printf("Job %zd: complete in %zd epochs, Validation Loss: %.3f, Accuracy: %.2f%%\n", job, result.epochs, result.validation.loss, result.validation.accuracy * 100);
+			}
+			return result;
+		}
+
+		bool Sweep::report(size_t epoch, float loss, float bestLoss, const SweepConfig& sweepConfig)
+		{
+			// Returns whether the job should continue
+			if (!std::isfinite(loss)) return false;
+			std::lock_guard<std::mutex> lock(reportMutex);
+			if (epochLosses.size() <= epoch) epochLosses.resize(epoch + 1);
+			std::vector<float> others = epochLosses[epoch];
+			epochLosses[epoch].push_back(loss);
+			if (epoch + 1 < sweepConfig.gracePeriod || others.size() < std::max(sweepConfig.minReports, (size_t)1)) return true;
+
+			std::nth_element(others.begin(), others.begin() + others.size() / 2, others.end());
+			return bestLoss <= others[others.size() / 2];
+		}
+
+		std::vector<TrainingConfig> Sweep::grid(const TrainingConfig& base, const std::vector<float>& learningRates, const std::vector<float>& momentumRates, const std::vector<int>& batchSizes)
+		{
+			std::vector<TrainingConfig> configs;
+			for (float learningRate : learningRates)
+			{
+				for (float momentumRate : momentumRates)
+				{
+					for (int batchSize : batchSizes)
+					{
+						TrainingConfig config = base;
+						config.learningRate = learningRate;
+						config.momentumRate = momentumRate;
+						config.batchSize = batchSize;
+						configs.push_back(config);
+					}
+				}
+			}
+			return configs;
+		}
+
+		void Sweep::printTable(std::vector<SweepResult> results)
+		{
+			std::sort(results.begin(), results.end(), [](const SweepResult& a, const SweepResult& b)
+			{
+				if (a.killed != b.killed) return !a.killed;
+				if (a.killed) return a.epochs > b.epochs;
+				return a.validation.loss < b.validation.loss;
+			});
+
+			printf("%5s %10s %10s %7s %7s %11s %10s %9s %10s  %s\n", "Job", "LR", "Momentum", "Batch", "Epochs", "Train Loss", "Val Loss", "Val Acc", "Time", "Status");
+			for (const SweepResult& result : results)
+			{
+				printf("%5zd %10.4g %10.4g %7d %7zd %11.4f ", result.job, result.config.learningRate, result.config.momentumRate, result.config.batchSize, result.epochs, result.trainLoss);
+				if (result.killed) printf("%10s %9s ", "-", "-");
+				else printf("%10.4f %8.2f%% ", result.validation.loss, result.validation.accuracy * 100);
+				printf("%9.1fs  %s\n", result.seconds, result.killed ? "killed" : "complete");
+			}
+			printf("\n");
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include "NeuralNetwork.h"
+
+namespace tbml
+{
+	namespace nn
+	{
+		struct SweepConfig
+		{
+			// Cores shared by all jobs, -1 for every core
+			int threadCount = -1;
+
+			// Jobs training at once, each given an equal share of the cores, 0 for one per core up to the job count
+			size_t concurrentJobs = 0;
+
+			// Median stopping, a job is killed once its best loss is worse than the median other jobs had at the same epoch
+			// Only after gracePeriod epochs and once minReports other jobs have reached that epoch, a non finite loss kills at once
+			size_t gracePeriod = 2;
+			size_t minReports = 3;
+			size_t logLevel = 1;
+		};
+
+		struct SweepResult
+		{
+			size_t job = 0;
+			TrainingConfig config;
+			size_t epochs = 0;
+			float trainLoss = 0.0f;
+			Evaluation validation;
+			double seconds = 0.0;
+			bool killed = false;
+		};
+
+		// Trains many configurations of one model concurrently on datasets loaded once and shared read only
+		// Jobs each train a fresh network from makeNetwork, clearly losing jobs are killed early to free their cores
+		class Sweep
+		{
+		public:
+			using NetworkFactory = std::function<NeuralNetwork()>;
+
+			// Tensors share storage with the given ones and are never written
+			Sweep(const Tensor& input, const Tensor& expected, const Tensor& validationInput, const Tensor& validationExpected);
+
+			std::vector<SweepResult> run(const NetworkFactory& makeNetwork, const std::vector<TrainingConfig>& configs, const tbml::fn::LossFunctionPtr& lossFn, const SweepConfig& sweepConfig);
+
+			// Every combination of the values over base, in order of learning rate then momentum then batch size
+			static std::vector<TrainingConfig> grid(const TrainingConfig& base, const std::vector<float>& learningRates, const std::vector<float>& momentumRates, const std::vector<int>& batchSizes);
+
+			// Completed jobs by validation loss then killed jobs by how long they lasted
+			static void printTable(std::vector<SweepResult> results);
+
+		private:
+			const Tensor input;
+			const Tensor expected;
+			const Tensor validationInput;
+			const Tensor validationExpected;
+
+			// Loss every job reported at each epoch, for median stopping
+			std::mutex reportMutex;
+			std::vector<std::vector<float>> epochLosses;
+
+			SweepResult runJob(size_t job, const NetworkFactory& makeNetwork, const TrainingConfig& config, const tbml::fn::LossFunctionPtr& lossFn, const SweepConfig& sweepConfig, int jobThreads);
+			bool report(size_t epoch, float loss, float bestLoss, const SweepConfig& sweepConfig);
+		};
+	}
+}
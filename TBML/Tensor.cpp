@@ -2,6 +2,7 @@
 #include <cassert>
 #include "stdafx.h"
 #include "Tensor.h"
+#include "Trace.h"
 
 namespace tbml
 {
@@ -11,14 +12,26 @@ namespace tbml
 	{
 		// Default constructor
 		shape = {};
-		data = {};
+		data = std::make_shared<std::vector<float>>();
 	}
 
 	Tensor::Tensor(const Tensor& t)
 	{
-		// Copy constructor
+		// Copy constructor, shares data until either side mutates
+		*this = t;
+	}
+
+	Tensor& Tensor::operator=(const Tensor& t)
+	{
+		// Share data with t, or take an owned copy if t is a view
+		if (this == &t) return *this;
 		shape = t.shape;
-		data = t.data;
+		if (t.view != nullptr) data = std::make_shared<std::vector<float>>(t.view, t.view + t.viewSize);
+		else data = t.data;
+		view = nullptr;
+		viewSize = 0;
+		viewCapacity = 0;
+		return *this;
 	}
 
 	Tensor::Tensor(const std::vector<size_t>& shape, float v)
@@ -27,7 +40,7 @@ namespace tbml
 		this->shape = shape;
 		size_t dataSize = 1;
 		for (size_t i = 0; i < getDims(); i++) dataSize *= shape[i];
-		data = std::vector<float>(dataSize, v);
+		data = std::make_shared<std::vector<float>>(dataSize, v);
 	}
 
 	Tensor::Tensor(const std::vector<size_t>& shape, const std::vector<float>& data)
@@ -37,26 +50,37 @@ namespace tbml
 		size_t dataSize = 1;
 		for (size_t i = 0; i < getDims(); i++) dataSize *= shape[i];
 		assert(dataSize == data.size());
-		this->data = data;
+		this->data = std::make_shared<std::vector<float>>(data);
+	}
+
+	Tensor::Tensor(const std::vector<size_t>& shape, std::vector<float>&& data)
+	{
+		// Create tensor with shape taking ownership of data
+		this->shape = shape;
+		size_t dataSize = 1;
+		for (size_t i = 0; i < getDims(); i++) dataSize *= shape[i];
+		assert(dataSize == data.size());
+		this->data = std::make_shared<std::vector<float>>(std::move(data));
 	}
 
 	Tensor::Tensor(const std::vector<float>& data)
 	{
 		// Create 1D tensor
 		this->shape = { data.size() };
-		this->data = data;
+		this->data = std::make_shared<std::vector<float>>(data);
 	}
 
 	Tensor::Tensor(const std::vector<std::vector<float>>& data)
 	{
 		// Create 2D tensor
 		shape = { data.size(), data[0].size() };
-		this->data = std::vector<float>(shape[0] * shape[1]);
+		this->data = std::make_shared<std::vector<float>>(shape[0] * shape[1]);
+		std::vector<float>& result = *this->data;
 		for (size_t row = 0; row < shape[0]; row++)
 		{
 			for (size_t col = 0; col < shape[1]; col++)
 			{
-				this->data[row + col * shape[0]] = data[row][col];
+				result[row + col * shape[0]] = data[row][col];
 			}
 		}
 	}
@@ -65,14 +89,15 @@ namespace tbml
 	{
 		// Create 3D tensor
 		shape = { data[0].size(), data[0][0].size(), data.size() };
-		this->data = std::vector<float>(shape[0] * shape[1] * shape[2]);
+		this->data = std::make_shared<std::vector<float>>(shape[0] * shape[1] * shape[2]);
+		std::vector<float>& result = *this->data;
 		for (size_t x = 0; x < shape[0]; x++)
 		{
 			for (size_t y = 0; y < shape[1]; y++)
 			{
 				for (size_t z = 0; z < shape[2]; z++)
 				{
-					this->data[x + y * shape[0] + z * shape[0] * shape[1]] = data[z][x][y];
+					result[x + y * shape[0] + z * shape[0] * shape[1]] = data[z][x][y];
 				}
 			}
 		}
@@ -80,27 +105,57 @@ namespace tbml
 
 	void Tensor::zero()
 	{
-		for (size_t i = 0; i < data.size(); i++) data[i] = 0;
+		// No need to copy shared data that is about to be overwritten
+		if (isShared()) data = std::make_shared<std::vector<float>>(data->size(), 0.0f);
+		else std::fill(_mutPtr(), _mutPtr() + getSize(), 0.0f);
 	}
 
 	void Tensor::setData(std::vector<size_t>&& shape, std::vector<float>&& data)
 	{
 		// Set tensor with shape and data and assert data fits
 		this->shape = std::move(shape);
-		this->data = std::move(data);
+		_setData(std::move(data));
+	}
+
+	void Tensor::bindView(float* memory, size_t capacity)
+	{
+		// Write into memory of capacity floats from now on, which must outlive the binding
+		// Starts empty, kernels writing to this give it a shape
+		assert(memory != nullptr);
+		shape = {};
+		data = nullptr;
+		view = memory;
+		viewSize = 0;
+		viewCapacity = capacity;
+	}
+
+	void Tensor::bindView(Tensor& t)
+	{
+		// View t's values in place, t is made private first so writes through either reach both
+		// t must not reallocate while bound
+		size_t size = t.getSize();
+		bindView(t._mutPtr(), size);
+		shape = t.shape;
+		viewSize = size;
+	}
+
+	void Tensor::unbindView()
+	{
+		// Back to owned empty data
+		if (view == nullptr) return;
+		shape = {};
+		data = std::make_shared<std::vector<float>>();
+		view = nullptr;
+		viewSize = 0;
+		viewCapacity = 0;
 	}
 
 	Tensor& Tensor::add(const Tensor& t)
 	{
-		if (getDims() == 0)
-		{
-			shape = t.shape;
-			data = t.data;
-			return *this;
-		}
+		if (getDims() == 0) return *this = t;
 
 		assert(shape == t.shape);
-		for (size_t i = 0; i < data.size(); i++) data[i] += t.data[i];
+		backend::get().add(getSize(), _mutPtr(), t._ptr());
 		return *this;
 	}
 
@@ -127,11 +182,7 @@ namespace tbml
 			// [ 0, 1, 2, 3 ] .. [ 4, 5, 6, 7 ]
 			// [ 0, 1, 2, 3 ] .. [ 4, 5, 6, 7 ]
 			// ni = i // 3
-			for (size_t i = 0; i < data.size(); i++)
-			{
-				int ni = (int)(i / shape[0]);
-				data[i] += t.data[ni];
-			}
+			backend::get().addRows(shape[0], getSize() / shape[0], _mutPtr(), t._ptr());
 		}
 
 		else if (moddim == 1)
@@ -140,10 +191,12 @@ namespace tbml
 			// [ 0, 0, 0, 0 ] .. [ 3, 3, 3, 3 ]
 			// [ 1, 1, 1, 1 ] .. [ 4, 4, 4, 4 ]
 			// [ 2, 2, 2, 2 ] .. [ 5, 5, 5, 5 ]
-			for (size_t i = 0; i < data.size(); i++)
+			float* result = _mutPtr();
+			const float* other = t._ptr();
+			for (size_t i = 0; i < getSize(); i++)
 			{
 				size_t ni = (i / (shape[0] * shape[1])) + (i % shape[0]);
-				data[i] += t.data[ni];
+				result[i] += other[ni];
 			}
 		}
 
@@ -152,77 +205,241 @@ namespace tbml
 
 	Tensor& Tensor::add(float v)
 	{
-		for (size_t i = 0; i < data.size(); i++) data[i] += v;
+		backend::get().add(getSize(), _mutPtr(), v);
 		return *this;
 	}
 
 	Tensor& Tensor::sub(const Tensor& t)
 	{
-		if (getDims() == 0)
-		{
-			shape = t.shape;
-			data = t.data;
-			for (size_t i = 0; i < data.size(); i++) data[i] = -data[i];
-			return *this;
-		}
-
-		assert(shape == t.shape);
-		for (size_t i = 0; i < data.size(); i++) data[i] -= t.data[i];
+		// Empty tensors subtract from zeros of the same shape
+		float* values = _prepareAccumulate(t.shape, 1.0f);
+		backend::get().sub(getSize(), values, t._ptr());
 		return *this;
 	}
 
 	Tensor& Tensor::sub(float v)
 	{
-		for (size_t i = 0; i < data.size(); i++) data[i] -= v;
+		backend::get().add(getSize(), _mutPtr(), -v);
 		return *this;
 	}
 
 	Tensor& Tensor::mult(const Tensor& t)
 	{
 		assert(shape == t.shape);
-		for (size_t i = 0; i < data.size(); i++) data[i] *= t.data[i];
+		backend::get().mult(getSize(), _mutPtr(), t._ptr());
 		return *this;
 	}
 
 	Tensor& Tensor::mult(float v)
 	{
-		for (size_t i = 0; i < data.size(); i++) data[i] *= v;
+		backend::get().mult(getSize(), _mutPtr(), v);
 		return *this;
 	}
 
 	Tensor& Tensor::div(const Tensor& t)
 	{
 		assert(shape == t.shape);
-		for (size_t i = 0; i < data.size(); i++) data[i] /= t.data[i];
+		backend::get().div(getSize(), _mutPtr(), t._ptr());
 		return *this;
 	}
 
 	Tensor& Tensor::div(float v)
 	{
-		for (size_t i = 0; i < data.size(); i++) data[i] /= v;
+		backend::get().div(getSize(), _mutPtr(), v);
 		return *this;
 	}
 
 	float Tensor::acc(std::function<float(float, float)> fn, float initial) const
 	{
+		const float* values = _ptr();
 		float acc = initial;
-		for (size_t i = 0; i < data.size(); i++) acc = fn(data[i], acc);
+		for (size_t i = 0; i < getSize(); i++) acc = fn(values[i], acc);
 		return acc;
 	}
 
+	float Tensor::sum() const
+	{
+		return backend::get().sum(getSize(), _ptr());
+	}
+
+	float Tensor::max() const
+	{
+		assert(getSize() > 0);
+		return backend::get().max(getSize(), _ptr());
+	}
+
 	Tensor& Tensor::map(std::function<float(float)> fn)
 	{
-		for (size_t i = 0; i < data.size(); i++) data[i] = fn(data[i]);
+		float* result = _mutPtr();
+		for (size_t i = 0; i < getSize(); i++) result[i] = fn(result[i]);
 		return *this;
 	}
 
 	Tensor& Tensor::ewise(const Tensor& t, std::function<float(float, float)> fn)
 	{
 		assert(shape == t.shape);
-		for (size_t i = 0; i < data.size(); i++) data[i] = fn(data[i], t.data[i]);
+		float* result = _mutPtr();
+		const float* other = t._ptr();
+		for (size_t i = 0; i < getSize(); i++) result[i] = fn(result[i], other[i]);
+		return *this;
+	}
+
+	Tensor& Tensor::activate(backend::Activation fn)
+	{
+		float* values = _mutPtr();
+		backend::get().activate(fn, getSize(), values, values);
+		return *this;
+	}
+
+	Tensor& Tensor::activate(backend::Activation fn, const Tensor& input)
+	{
+		// this = fn(input)
+		assert(this != &input);
+		float* values = _prepareAccumulate(input.shape, 0.0f);
+		backend::get().activate(fn, getSize(), input._ptr(), values);
+		return *this;
+	}
+
+	Tensor Tensor::activated(backend::Activation fn) const
+	{
+		return Tensor().activate(fn, *this);
+	}
+
+	Tensor& Tensor::activationGrad(backend::Activation fn, const Tensor& output, const Tensor& gradOutput)
+	{
+		// this = gradient to the activation input given its output and gradient to the output
+		assert(output.shape == gradOutput.shape);
+		float* values = _prepareAccumulate(output.shape, 0.0f);
+		backend::get().activateGrad(fn, getSize(), output._ptr(), gradOutput._ptr(), values);
+		return *this;
+	}
+
+	Tensor& Tensor::softmaxGrad(const Tensor& output, const Tensor& gradOutput)
+	{
+		// this = gradient to the softmax input given its output and gradient to the output
+		if (output.getDims() != 2) throw std::runtime_error("Softmax only defined for 2D tensors");
+		assert(output.shape == gradOutput.shape);
+		float* values = _prepareAccumulate(output.shape, 0.0f);
+		backend::get().softmaxGrad(output.shape[0], output.shape[1], output._ptr(), gradOutput._ptr(), values);
+		return *this;
+	}
+
+	float Tensor::softmaxCrossEntropyGrad(const Tensor& logits, const Tensor& expected)
+	{
+		// this = gradient of cross entropy of softmax(logits) to logits, returns the loss from the same pass
+		if (logits.getDims() != 2) throw std::runtime_error("Softmax only defined for 2D tensors");
+		assert(logits.shape == expected.shape);
+		float* values = _prepareAccumulate(logits.shape, 0.0f);
+		return backend::get().softmaxCrossEntropy(logits.shape[0], logits.shape[1], logits._ptr(), expected._ptr(), values);
+	}
+
+	float Tensor::squareErrorGrad(const Tensor& output, const Tensor& expected)
+	{
+		// this = gradient of square error to output, returns the summed loss from the same pass
+		assert(output.shape == expected.shape);
+		float* values = _prepareAccumulate(output.shape, 0.0f);
+		return backend::get().squareError(output.getSize(), output._ptr(), expected._ptr(), values);
+	}
+
+	float Tensor::crossEntropyGrad(const Tensor& output, const Tensor& expected)
+	{
+		// this = gradient of cross entropy to output, returns the summed loss from the same pass
+		assert(output.shape == expected.shape);
+		float* values = _prepareAccumulate(output.shape, 0.0f);
+		return backend::get().crossEntropy(output.getSize(), output._ptr(), expected._ptr(), values);
+	}
+
+	Tensor& Tensor::softmax()
+	{
+		// Softmax of each row
+		if (getDims() != 2) throw std::runtime_error("Softmax only defined for 2D tensors");
+		float* values = _mutPtr();
+		backend::get().softmax(shape[0], shape[1], values, values);
+		return *this;
+	}
+
+	Tensor& Tensor::softmax(const Tensor& input)
+	{
+		// this = softmax of each row of input
+		if (input.getDims() != 2) throw std::runtime_error("Softmax only defined for 2D tensors");
+		assert(this != &input);
+		float* values = _prepareAccumulate(input.shape, 0.0f);
+		backend::get().softmax(input.shape[0], input.shape[1], input._ptr(), values);
+		return *this;
+	}
+
+	Tensor& Tensor::axpy(float alpha, const Tensor& x)
+	{
+		// this = alpha * x + this
+		return axpby(alpha, x, 1.0f);
+	}
+
+	Tensor& Tensor::axpby(float alpha, const Tensor& x, float beta)
+	{
+		// this = alpha * x + beta * this, in place with no temporaries
+		float* y = _prepareAccumulate(x.shape, beta);
+		backend::get().axpby(getSize(), alpha, x._ptr(), beta, y);
+		return *this;
+	}
+
+	Tensor& Tensor::multAcc(float alpha, const Tensor& a, const Tensor& b, float beta)
+	{
+		// this = alpha * (a * b) + beta * this elementwise
+		assert(a.shape == b.shape);
+		float* y = _prepareAccumulate(a.shape, beta);
+		backend::get().multAcc(getSize(), alpha, a._ptr(), b._ptr(), beta, y);
 		return *this;
 	}
 
+	Tensor& Tensor::sgdMomentumStep(const Tensor& grad, Tensor& momentum, float learningRate, float momentumRate)
+	{
+		// this += momentum = momentumRate * momentum - learningRate * grad, in one pass
+		assert(grad.shape == shape);
+		float* momentumValues = momentum._prepareAccumulate(shape, 1.0f);
+		backend::get().sgdMomentum(getSize(), learningRate, momentumRate, grad._ptr(), momentumValues, _mutPtr());
+		return *this;
+	}
+
+	Tensor& Tensor::adamStep(const Tensor& grad, Tensor& m, Tensor& v, float learningRate, float beta1, float beta2, float epsilon, float weightDecay, size_t t)
+	{
+		// Update moments m and v then this in one pass, see backend::Base::adam
+		assert(grad.shape == shape);
+		float* mValues = m._prepareAccumulate(shape, 1.0f);
+		float* vValues = v._prepareAccumulate(shape, 1.0f);
+		backend::get().adam(getSize(), learningRate, beta1, beta2, epsilon, weightDecay, t, grad._ptr(), mValues, vValues, _mutPtr());
+		return *this;
+	}
+
+	Tensor& Tensor::gemm(float alpha, const Tensor& a, const Tensor& b, float beta, bool transA, bool transB)
+	{
+		// this = alpha * (op(a) matmul op(b)) + beta * this, op(x) = x^T if trans
+		if (a.getDims() != 2 || b.getDims() != 2) throw std::runtime_error("Invalid shape for gemm");
+		assert(this != &a && this != &b);
+		size_t m = transA ? a.shape[1] : a.shape[0];
+		size_t k = transA ? a.shape[0] : a.shape[1];
+		size_t n = transB ? b.shape[0] : b.shape[1];
+		assert(k == (transB ? b.shape[1] : b.shape[0]));
+		trace::Scope scope("Tensor::gemm", "m", m);
+		float* c = _prepareAccumulate({ m, n }, beta);
+		backend::get().gemm(transA, transB, m, n, k, alpha, a._ptr(), b._ptr(), beta, c);
+		return *this;
+	}
+
+	Tensor& Tensor::sumRows(float alpha, const Tensor& a, float beta)
+	{
+		// this (1 x n) = alpha * Σ rows of a + beta * this
+		if (a.getDims() != 2) throw std::runtime_error("Invalid shape for sumRows");
+		assert(this != &a);
+		float* out = _prepareAccumulate({ 1, a.shape[1] }, beta);
+		backend::get().sumRows(a.shape[0], a.shape[1], alpha, a._ptr(), beta, out);
+		return *this;
+	}
+
+	Tensor Tensor::softmaxed() const
+	{
+		return Tensor().softmax(*this);
+	}
+
 	Tensor& Tensor::matmul(const Tensor& t)
 	{
 		if (getDims() == 1)
@@ -236,24 +453,10 @@ namespace tbml
 		{
 			assert(getShape(1) == t.getShape(0));
 
-			const std::vector<float>& a = data;
-			const std::vector<float>& b = t.data;
+			trace::Scope scope("Tensor::matmul", "m", shape[0]);
 			std::vector<float> result(shape[0] * t.shape[1]);
-
-			#pragma omp parallel for num_threads(12)
-			for (int row = 0; row < (int)shape[0]; row++)
-			{
-				for (int ocol = 0; ocol < (int)t.shape[1]; ocol++)
-				{
-					for (int i = 0; i < (int)shape[1]; i++)
-					{
-						// TODO: See if can use operator()
-						result[row + shape[0] * ocol] += a[row + shape[0] * i] * b[i + t.shape[0] * ocol];
-					}
-				}
-			}
-
-			data = std::move(result);
+			backend::get().gemm(false, false, shape[0], t.shape[1], shape[1], 1.0f, _ptr(), t._ptr(), 0.0f, result.data());
+			_setData(std::move(result));
 			shape[1] = t.shape[1];
 			return *this;
 		}
@@ -261,6 +464,108 @@ namespace tbml
 		throw std::runtime_error("Invalid shape for matrix multiplication");
 	}
 
+	Tensor& Tensor::matmul(const PackedMatrix& t)
+	{
+		if (getDims() != 2) throw std::runtime_error("Invalid shape for matrix multiplication");
+		assert(getShape(1) == t.rows);
+
+		trace::Scope scope("Tensor::matmul", "m", shape[0]);
+		std::vector<float> result(shape[0] * t.cols);
+		backend::get().gemmPacked(shape[0], t.cols, shape[1], 1.0f, _ptr(), t.data.data(), 0.0f, result.data());
+		_setData(std::move(result));
+		shape[1] = t.cols;
+		return *this;
+	}
+
+	Tensor& Tensor::matmul(const PackedMatrix& t, const Tensor& bias, backend::Activation fn)
+	{
+		*this = matmulled(t, bias, fn);
+		return *this;
+	}
+
+	Tensor Tensor::matmulled(const PackedMatrix& t, const Tensor& bias, backend::Activation fn) const
+	{
+		return Tensor().gemmBiasActivate(*this, t, bias, fn);
+	}
+
+	Tensor& Tensor::gemmBiasActivate(const Tensor& a, const PackedMatrix& b, const Tensor& bias, backend::Activation fn)
+	{
+		// Matmul with bias and activation fused into the kernel, this = fn(a * b + bias)
+		if (a.getDims() != 2) throw std::runtime_error("Invalid shape for matrix multiplication");
+		assert(this != &a);
+		assert(a.getShape(1) == b.rows);
+		assert(bias.getSize() == 0 || bias.getSize() == b.cols);
+
+		trace::Scope scope("Tensor::gemmBiasActivate", "m", a.shape[0]);
+		float* c = _prepareAccumulate({ a.shape[0], b.cols }, 0.0f);
+		const float* biasValues = bias.getSize() > 0 ? bias._ptr() : nullptr;
+		backend::get().gemmBiasActivate(a.shape[0], b.cols, a.shape[1], a._ptr(), b.data.data(), biasValues, fn, c);
+		return *this;
+	}
+
+	Tensor& Tensor::matmul(const Tensor& t, const Tensor& bias, backend::Activation fn)
+	{
+		*this = Tensor().gemmBiasActivate(*this, t, bias, fn);
+		return *this;
+	}
+
+	Tensor& Tensor::gemmBiasActivate(const Tensor& a, const Tensor& b, const Tensor& bias, backend::Activation fn)
+	{
+		// As with packed b, for backends that prefer unpacked weights
+		if (a.getDims() != 2 || b.getDims() != 2) throw std::runtime_error("Invalid shape for matrix multiplication");
+		assert(this != &a && this != &b);
+		assert(a.getShape(1) == b.shape[0]);
+		assert(bias.getSize() == 0 || bias.getSize() == b.shape[1]);
+
+		trace::Scope scope("Tensor::gemmBiasActivate", "m", a.shape[0]);
+		float* c = _prepareAccumulate({ a.shape[0], b.shape[1] }, 0.0f);
+		const float* biasValues = bias.getSize() > 0 ? bias._ptr() : nullptr;
+		backend::get().gemmBiasActivateUnpacked(a.shape[0], b.shape[1], a.shape[1], a._ptr(), b._ptr(), biasValues, fn, c);
+		return *this;
+	}
+
+	Tensor& Tensor::matmul(const SparseMatrix& t, const Tensor& bias, backend::Activation fn)
+	{
+		*this = Tensor().gemmBiasActivate(*this, t, bias, fn);
+		return *this;
+	}
+
+	Tensor& Tensor::gemmBiasActivate(const Tensor& a, const SparseMatrix& b, const Tensor& bias, backend::Activation fn)
+	{
+		// Sparse matmul with bias and activation fused into the kernel, this = fn(a * b + bias)
+		if (a.getDims() != 2) throw std::runtime_error("Invalid shape for matrix multiplication");
+		assert(this != &a);
+		assert(a.getShape(1) == b.rows);
+		assert(bias.getSize() == 0 || bias.getSize() == b.cols);
+
+		trace::Scope scope("Tensor::sparseGemmBiasActivate", "m", a.shape[0]);
+		float* c = _prepareAccumulate({ a.shape[0], b.cols }, 0.0f);
+		const float* biasValues = bias.getSize() > 0 ? bias._ptr() : nullptr;
+		backend::get().sparseGemmBiasActivate(a.shape[0], b.cols, a._ptr(), b.colStarts.data(), b.rowIndices.data(), b.values.data(), biasValues, fn, c);
+		return *this;
+	}
+
+	Tensor& Tensor::gemv(const Tensor& t, const Tensor& bias, backend::Activation fn)
+	{
+		// Row vector matmul with fused bias add and activation, this = fn(this * t + bias)
+		*this = Tensor().gemvBiasActivate(*this, t, bias, fn);
+		return *this;
+	}
+
+	Tensor& Tensor::gemvBiasActivate(const Tensor& x, const Tensor& w, const Tensor& bias, backend::Activation fn)
+	{
+		// Row vector matmul with fused bias add and activation, this = fn(x * w + bias)
+		if (x.getDims() != 2 || x.shape[0] != 1) throw std::runtime_error("Invalid shape for gemv");
+		assert(this != &x && this != &w);
+		assert(w.getDims() == 2 && x.shape[1] == w.shape[0]);
+		assert(bias.getSize() == 0 || bias.getSize() == w.shape[1]);
+
+		float* y = _prepareAccumulate({ 1, w.shape[1] }, 0.0f);
+		const float* biasValues = bias.getSize() > 0 ? bias._ptr() : nullptr;
+		backend::get().gemv(w.shape[1], x.shape[1], x._ptr(), w._ptr(), biasValues, fn, y);
+		return *this;
+	}
+
 	Tensor& Tensor::transpose()
 	{
 		if (getDims() == 1)
@@ -277,11 +582,11 @@ namespace tbml
 			{
 				for (size_t col = 0; col < shape[1]; col++)
 				{
-					result[col + shape[1] * row] = data[row + shape[0] * col];
+					result[col + shape[1] * row] = _ptr()[row + shape[0] * col];
 				}
 			}
 
-			data = std::move(result);
+			_setData(std::move(result));
 			shape = { shape[1], shape[0] };
 			return *this;
 		}
@@ -291,20 +596,226 @@ namespace tbml
 
 	Tensor Tensor::sample(size_t dim, std::vector<size_t> indices) const
 	{
-		assert(getDims() == 2);
+		return Tensor().sample(*this, dim, indices);
+	}
+
+	Tensor& Tensor::sample(const Tensor& t, size_t dim, const std::vector<size_t>& indices)
+	{
+		assert(t.getDims() == 2);
 		assert(dim == 0);
+		assert(this != &t);
+
+		// Only implemented for dim 0 of 2D tensor, this = rows of t at indices
+		// Walk each column in turn so writes are contiguous, as are reads for consecutive indices
+		size_t cols = t.shape[1];
+		float* result = _prepareAccumulate({ indices.size(), cols }, 0.0f);
+		const float* values = t._ptr();
+		for (size_t j = 0; j < cols; j++)
+		{
+			const float* column = values + t.shape[0] * j;
+			float* resultColumn = result + indices.size() * j;
+			for (size_t i = 0; i < indices.size(); i++) resultColumn[i] = column[indices[i]];
+		}
+
+		return *this;
+	}
 
-		// Only implemented for dim 0 of 2D tensor
-		std::vector<float> result(indices.size() * shape[1]);
-		for (size_t i = 0; i < indices.size(); i++)
+	Tensor& Tensor::concatColumns(const std::vector<const Tensor*>& tensors)
+	{
+		assert(tensors.size() > 0);
+
+		// this = [t0 t1 ...] joined along dim 1 of 2D tensors with equal rows
+		// Columns are contiguous so each tensor is a single block copy
+		size_t rows = tensors[0]->shape[0];
+		size_t cols = 0;
+		for (const Tensor* t : tensors)
 		{
-			for (size_t j = 0; j < shape[1]; j++)
+			assert(t->getDims() == 2 && t->shape[0] == rows);
+			assert(t != this);
+			cols += t->shape[1];
+		}
+		float* result = _prepareAccumulate({ rows, cols }, 0.0f);
+		for (const Tensor* t : tensors) result = std::copy(t->_ptr(), t->_ptr() + t->getSize(), result);
+		return *this;
+	}
+
+	Tensor& Tensor::sliceColumns(const Tensor& t, size_t first, size_t count)
+	{
+		assert(t.getDims() == 2 && first + count <= t.shape[1]);
+		assert(this != &t);
+
+		// this = columns [first, first + count) of 2D t, the inverse of concatColumns
+		size_t rows = t.shape[0];
+		float* result = _prepareAccumulate({ rows, count }, 0.0f);
+		const float* values = t._ptr() + rows * first;
+		std::copy(values, values + rows * count, result);
+		return *this;
+	}
+
+	Tensor& Tensor::reshape(std::initializer_list<size_t> newShape)
+	{
+		// Reinterpret the values in place, column-major order is unchanged so no data moves
+		// Shape is an initializer list so per batch callers need no temporary vectors
+		size_t size = 1;
+		for (size_t dim : newShape) size *= dim;
+		if (size != getSize()) throw std::runtime_error("Invalid shape for reshape");
+		shape.assign(newShape.begin(), newShape.end());
+		return *this;
+	}
+
+	Tensor& Tensor::reshape(const Tensor& t, std::initializer_list<size_t> newShape)
+	{
+		assert(this != &t);
+
+		// this = t's values with newShape, copied into this's storage so t's owner can keep reusing its own
+		size_t size = 1;
+		for (size_t dim : newShape) size *= dim;
+		if (size != t.getSize()) throw std::runtime_error("Invalid shape for reshape");
+		float* result = _prepareAccumulate(newShape, 0.0f);
+		std::copy(t._ptr(), t._ptr() + t.getSize(), result);
+		return *this;
+	}
+
+	Tensor& Tensor::im2col(const Tensor& input, const backend::ConvShape& conv)
+	{
+		assert(input.getDims() == 2 && input.shape[1] == conv.getInputSize());
+		assert(this != &input);
+
+		// this ((batch * outHeight * outWidth) x patch size) = patches of input (batch x channels * height * width), see backend::Base::im2col
+		size_t batch = input.shape[0];
+		trace::Scope scope("Tensor::im2col", "m", batch);
+		float* columns = _prepareAccumulate({ batch * conv.getOutHeight() * conv.getOutWidth(), conv.getPatchSize() }, 0.0f);
+		backend::get().im2col(conv, batch, input._ptr(), columns);
+		return *this;
+	}
+
+	Tensor& Tensor::col2im(const Tensor& columns, const backend::ConvShape& conv)
+	{
+		size_t pixels = conv.getOutHeight() * conv.getOutWidth();
+		assert(columns.getDims() == 2 && columns.shape[0] % pixels == 0 && columns.shape[1] == conv.getPatchSize());
+		assert(this != &columns);
+
+		// this (batch x channels * height * width) = columns summed back into the pixels im2col read them from
+		size_t batch = columns.shape[0] / pixels;
+		trace::Scope scope("Tensor::col2im", "m", batch);
+		float* result = _prepareAccumulate({ batch, conv.getInputSize() }, 0.0f);
+		backend::get().col2im(conv, batch, columns._ptr(), result);
+		return *this;
+	}
+
+	void Tensor::argmaxRows(std::vector<uint32_t>& indices) const
+	{
+		// indices = column of the largest value in each row of a 2D tensor, reusing indices' storage
+		assert(getDims() == 2 && shape[1] > 0);
+		indices.resize(shape[0]);
+		backend::get().argmaxRows(shape[0], shape[1], _ptr(), indices.data());
+	}
+
+	PackedMatrix Tensor::packPanels() const
+	{
+		PackedMatrix packed;
+		packPanels(packed);
+		return packed;
+	}
+
+	void Tensor::packPanels(PackedMatrix& packed) const
+	{
+		assert(getDims() == 2);
+
+		// Repack into packed reusing its storage, padding stays zero
+		size_t panels = (shape[1] + PackedMatrix::PANEL_WIDTH - 1) / PackedMatrix::PANEL_WIDTH;
+		size_t packedSize = panels * PackedMatrix::PANEL_WIDTH * shape[0];
+		if (packed.rows != shape[0] || packed.cols != shape[1] || packed.data.size() != packedSize) packed.data.assign(packedSize, 0.0f);
+		packed.rows = shape[0];
+		packed.cols = shape[1];
+		backend::packPanels(shape[0], shape[1], _ptr(), packed.data.data());
+	}
+
+	SparseMatrix Tensor::packSparse() const
+	{
+		SparseMatrix sparse;
+		packSparse(sparse);
+		return sparse;
+	}
+
+	void Tensor::packSparse(SparseMatrix& sparse) const
+	{
+		assert(getDims() == 2);
+
+		// Repack into sparse reusing its storage, keeping only exact nonzeros in row order per column
+		const float* values = _ptr();
+		sparse.rows = shape[0];
+		sparse.cols = shape[1];
+		sparse.colStarts.resize(shape[1] + 1);
+		sparse.rowIndices.clear();
+		sparse.values.clear();
+		for (size_t col = 0; col < shape[1]; col++)
+		{
+			sparse.colStarts[col] = (uint32_t)sparse.values.size();
+			const float* column = values + col * shape[0];
+			for (size_t row = 0; row < shape[0]; row++)
+			{
+				if (column[row] == 0.0f) continue;
+				sparse.rowIndices.push_back((uint32_t)row);
+				sparse.values.push_back(column[row]);
+			}
+		}
+		sparse.colStarts[shape[1]] = (uint32_t)sparse.values.size();
+	}
+
+	size_t Tensor::getNonZeroCount() const
+	{
+		const float* values = _ptr();
+		size_t size = getSize();
+		size_t count = 0;
+		for (size_t i = 0; i < size; i++) count += values[i] != 0.0f ? 1 : 0;
+		return count;
+	}
+
+	float* Tensor::_prepareAccumulate(const size_t* targetShape, size_t targetDims, float beta)
+	{
+		// Shape is passed as a raw array so callers need no temporary vectors
+		bool isSameShape = shape.size() == targetDims;
+		for (size_t i = 0; isSameShape && i < targetDims; i++) isSameShape = shape[i] == targetShape[i];
+
+		// Empty tensors accumulate as zeros of the target shape
+		if (getDims() == 0 || (beta == 0.0f && !isSameShape))
+		{
+			size_t dataSize = 1;
+			for (size_t i = 0; i < targetDims; i++) dataSize *= targetShape[i];
+			if (view != nullptr)
 			{
-				result[i + indices.size() * j] = data[indices[i] + shape[0] * j];
+				if (dataSize > viewCapacity) throw std::runtime_error("Tensor view capacity exceeded");
+				viewSize = dataSize;
+				if (beta != 0.0f) std::fill(view, view + dataSize, 0.0f);
 			}
+
+			// Reuse unshared storage, only new elements are initialized when it grows
+			else if (isShared()) data = std::make_shared<std::vector<float>>(dataSize, 0.0f);
+			else if (beta != 0.0f) data->assign(dataSize, 0.0f);
+			else data->resize(dataSize);
+			shape.assign(targetShape, targetShape + targetDims);
+			return _mutPtr();
 		}
 
-		return Tensor({ indices.size(), shape[1] }, result);
+		assert(isSameShape);
+
+		// Old values are not read when beta is 0 so shared data need not be copied
+		if (beta == 0.0f && isShared()) data = std::make_shared<std::vector<float>>(data->size(), 0.0f);
+		return _mutPtr();
+	}
+
+	void Tensor::_setData(std::vector<float>&& newData)
+	{
+		// Views copy into their memory, otherwise replace data reusing the shared_ptr if not shared
+		if (view != nullptr)
+		{
+			if (newData.size() > viewCapacity) throw std::runtime_error("Tensor view capacity exceeded");
+			std::copy(newData.begin(), newData.end(), view);
+			viewSize = newData.size();
+		}
+		else if (data.use_count() > 1) data = std::make_shared<std::vector<float>>(std::move(newData));
+		else *data = std::move(newData);
 	}
 
 	void Tensor::print(std::string tag) const
@@ -316,21 +827,22 @@ namespace tbml
 		std::cout << "\t( " << shapeStr << ")" << std::endl;
 
 		std::string dataStr;
+		const float* values = _ptr();
 
 		if (getDims() == 1)
 		{
-			if (data.size() > 50) dataStr += "\t[ ... ]";
+			if (getSize() > 50) dataStr += "\t[ ... ]";
 			else
 			{
 				dataStr += "\t[ ";
-				for (size_t i = 0; i < data.size(); i++) dataStr += std::to_string(data[i]) + " ";
+				for (size_t i = 0; i < getSize(); i++) dataStr += std::to_string(values[i]) + " ";
 				dataStr += "]";
 			}
 		}
 
 		else if (getDims() == 2)
 		{
-			if (data.size() > 50) dataStr += "\t[ ... ]";
+			if (getSize() > 50) dataStr += "\t[ ... ]";
 			else
 			{
 				for (size_t x = 0; x < shape[0]; x++)
@@ -338,7 +850,7 @@ namespace tbml
 					dataStr += "\t[ ";
 					for (size_t y = 0; y < shape[1]; y++)
 					{
-						dataStr += std::to_string(data[x + shape[0] * y]) + " ";
+						dataStr += std::to_string(values[x + shape[0] * y]) + " ";
 					}
 					dataStr += "]\n";
 				}
@@ -391,7 +903,8 @@ namespace tbml
 		os << getDims() << "\n";
 		for (size_t i = 0; i < getDims(); i++) os << shape[i] << " ";
 		os << "\n";
-		for (size_t i = 0; i < data.size(); i++) os << data[i] << " ";
+		const float* values = _ptr();
+		for (size_t i = 0; i < getSize(); i++) os << values[i] << " ";
 		os << "\n";
 	}
 
@@ -1,11 +1,52 @@
 #pragma once
 
+#include <cassert>
 #include <functional>
+#include <memory>
+#include <vector>
+#include "Backend.h"
 
 namespace tbml
 {
+	// Columns of a 2D tensor packed into fixed width panels for the matmul micro-kernel
+	// e.g. panel p = columns [p * PANEL_WIDTH, (p + 1) * PANEL_WIDTH) interleaved per row, zero padded
+	struct PackedMatrix
+	{
+		static const size_t PANEL_WIDTH = backend::PANEL_WIDTH;
+
+		size_t rows = 0;
+		size_t cols = 0;
+		std::vector<float> data;
+
+		bool isEmpty() const { return data.empty(); }
+	};
+
+	// Nonzeros of a 2D tensor compressed by column (CSC) for the sparse matmul kernel
+	// e.g. column c = values[colStarts[c], colStarts[c + 1]) at rows rowIndices[colStarts[c], colStarts[c + 1])
+	struct SparseMatrix
+	{
+		size_t rows = 0;
+		size_t cols = 0;
+		std::vector<uint32_t> colStarts;
+		std::vector<uint32_t> rowIndices;
+		std::vector<float> values;
+
+		// Densities at or below which the sparse kernel beats the packed GEMM and the dense gemv
+		// Measured on 784 x 100 and 256 x 256 layers, batches break even near 0.5 and single rows near 0.2
+		static constexpr float MAX_GEMM_DENSITY = 0.4f;
+		static constexpr float MAX_GEMV_DENSITY = 0.15f;
+
+		size_t getNonZeroCount() const { return values.size(); }
+		float getDensity() const { return rows * cols > 0 ? (float)values.size() / (rows * cols) : 0.0f; }
+		bool isEmpty() const { return colStarts.empty(); }
+		bool isFasterFor(size_t inputRows) const { return !isEmpty() && getDensity() <= (inputRows == 1 ? MAX_GEMV_DENSITY : MAX_GEMM_DENSITY); }
+	};
+
 	// Column-major order vector<float> based tensor
 	// e.g. shape[0] = rows, shape[1] = columns, ...
+	// Copies share data until one side mutates (copy-on-write)
+	// A bound view writes straight into external memory it does not own, e.g. a MemoryPlan arena
+	// Copying a view takes an owned copy so views never outlive their binding
 	class Tensor
 	{
 	public:
@@ -13,19 +54,24 @@ namespace tbml
 
 		Tensor();
 		Tensor(const Tensor& t);
+		Tensor& operator=(const Tensor& t);
 		Tensor(const std::vector<size_t>& shape, float v);
 		Tensor(const std::vector<size_t>& shape, const std::vector<float>& data);
+		Tensor(const std::vector<size_t>& shape, std::vector<float>&& data);
 		Tensor(const std::vector<float>& data);
 		Tensor(const std::vector<std::vector<float>>& data);
 		Tensor(const std::vector<std::vector<std::vector<float>>>& data);
 		void zero();
 		void setData(std::vector<size_t>&& shape, std::vector<float>&& data);
+		void bindView(float* memory, size_t capacity);
+		void bindView(Tensor& t);
+		void unbindView();
 
 		template<typename... Args>
-		float& at(Args... args) { return data[_getIndex(0, 1, args...)]; }
+		float& at(Args... args) { return _mutPtr()[_getIndex(0, 1, args...)]; }
 
 		template<typename... Args>
-		float at(Args... args) const { return data[_getIndex(0, 1, args...)]; }
+		float at(Args... args) const { return _ptr()[_getIndex(0, 1, args...)]; }
 
 		template<typename... Args>
 		float& operator()(Args... args) { return at(args...); }
@@ -43,15 +89,59 @@ namespace tbml
 		Tensor& div(const Tensor& t);
 		Tensor& div(float v);
 		float acc(std::function<float(float, float)> fn, float initial) const;
+		float sum() const;
+		float max() const;
 		Tensor& map(std::function<float(float)> fn);
 		Tensor& ewise(const Tensor& t, std::function<float(float, float)> fn);
+		Tensor& activate(backend::Activation fn);
+		Tensor& activate(backend::Activation fn, const Tensor& input);
+		Tensor& activationGrad(backend::Activation fn, const Tensor& output, const Tensor& gradOutput);
+		Tensor& softmax();
+		Tensor& softmax(const Tensor& input);
+		Tensor& softmaxGrad(const Tensor& output, const Tensor& gradOutput);
+		float softmaxCrossEntropyGrad(const Tensor& logits, const Tensor& expected);
+		float squareErrorGrad(const Tensor& output, const Tensor& expected);
+		float crossEntropyGrad(const Tensor& output, const Tensor& expected);
+		Tensor& axpy(float alpha, const Tensor& x);
+		Tensor& axpby(float alpha, const Tensor& x, float beta);
+		Tensor& multAcc(float alpha, const Tensor& a, const Tensor& b, float beta);
+		Tensor& sgdMomentumStep(const Tensor& grad, Tensor& momentum, float learningRate, float momentumRate);
+		Tensor& adamStep(const Tensor& grad, Tensor& m, Tensor& v, float learningRate, float beta1, float beta2, float epsilon, float weightDecay, size_t t);
+		Tensor& gemm(float alpha, const Tensor& a, const Tensor& b, float beta, bool transA = false, bool transB = false);
+		Tensor& sumRows(float alpha, const Tensor& a, float beta);
 		Tensor& matmul(const Tensor& t);
+		Tensor& matmul(const PackedMatrix& t);
+		Tensor& matmul(const PackedMatrix& t, const Tensor& bias, backend::Activation fn);
+		Tensor& gemmBiasActivate(const Tensor& a, const PackedMatrix& b, const Tensor& bias, backend::Activation fn);
+		Tensor& matmul(const Tensor& t, const Tensor& bias, backend::Activation fn);
+		Tensor& gemmBiasActivate(const Tensor& a, const Tensor& b, const Tensor& bias, backend::Activation fn);
+		Tensor& matmul(const SparseMatrix& t, const Tensor& bias, backend::Activation fn);
+		Tensor& gemmBiasActivate(const Tensor& a, const SparseMatrix& b, const Tensor& bias, backend::Activation fn);
+		Tensor& gemv(const Tensor& t, const Tensor& bias, backend::Activation fn = backend::Activation::Identity);
+		Tensor& gemvBiasActivate(const Tensor& x, const Tensor& w, const Tensor& bias, backend::Activation fn);
 		Tensor& transpose();
 		Tensor mapped(std::function<float(float)> fn) const { return Tensor(*this).map(fn); }
 		Tensor ewised(const Tensor& t, std::function<float(float, float)> fn) const { return Tensor(*this).ewise(t, fn); }
+		Tensor activated(backend::Activation fn) const;
+		Tensor softmaxed() const;
 		Tensor matmulled(const Tensor& t) const { return Tensor(*this).matmul(t); }
+		Tensor matmulled(const PackedMatrix& t) const { return Tensor(*this).matmul(t); }
+		Tensor matmulled(const PackedMatrix& t, const Tensor& bias, backend::Activation fn) const;
 		Tensor transposed() const { return Tensor(*this).transpose(); }
 		Tensor sample(size_t dim, std::vector<size_t> indices) const;
+		Tensor& sample(const Tensor& t, size_t dim, const std::vector<size_t>& indices);
+		Tensor& concatColumns(const std::vector<const Tensor*>& tensors);
+		Tensor& sliceColumns(const Tensor& t, size_t first, size_t count);
+		Tensor& reshape(std::initializer_list<size_t> newShape);
+		Tensor& reshape(const Tensor& t, std::initializer_list<size_t> newShape);
+		Tensor& im2col(const Tensor& input, const backend::ConvShape& conv);
+		Tensor& col2im(const Tensor& columns, const backend::ConvShape& conv);
+		PackedMatrix packPanels() const;
+		void packPanels(PackedMatrix& packed) const;
+		SparseMatrix packSparse() const;
+		void packSparse(SparseMatrix& sparse) const;
+		size_t getNonZeroCount() const;
+		void argmaxRows(std::vector<uint32_t>& indices) const;
 
 		Tensor& operator+=(const Tensor& t) { return add(t); }
 		Tensor& operator+=(float v) { return add(v); }
@@ -75,16 +165,43 @@ namespace tbml
 		const std::vector<size_t> getShape() const { return shape; }
 		const size_t getShape(size_t dim) const { return dim <= shape.size() ? shape[dim] : 1; }
 		const size_t getDims() const { return shape.size(); }
-		const size_t getSize() const { return data.size(); }
-		const std::vector<float>& getData() const { return data; }
+		const size_t getSize() const { return view != nullptr ? viewSize : data->size(); }
+		const std::vector<float>& getData() const { assert(view == nullptr && "Views have no owned data"); return *data; }
+		bool isShared() const { return view == nullptr && data.use_count() > 1; }
+		bool isView() const { return view != nullptr; }
 		bool isZero() const;
 
+		// Gives this newShape and returns its values for a kernel outside Tensor to overwrite, reusing unshared storage
+		float* prepareOverwrite(std::initializer_list<size_t> newShape) { return _prepareAccumulate(newShape, 0.0f); }
+
 		void serialize(std::ostream& os) const;
 		static Tensor deserialize(std::istream& is);
 
 	private:
 		std::vector<size_t> shape;
-		std::vector<float> data;
+		std::shared_ptr<std::vector<float>> data;
+
+		// Bound external memory, data is null while bound
+		float* view = nullptr;
+		size_t viewSize = 0;
+		size_t viewCapacity = 0;
+
+		const float* _ptr() const { return view != nullptr ? view : data->data(); }
+		float* _mutPtr() { return view != nullptr ? view : _mutData().data(); }
+
+		std::vector<float>& _mutData()
+		{
+			// Take a private copy before writing if the data is shared
+			assert(view == nullptr);
+			if (data.use_count() > 1) data = std::make_shared<std::vector<float>>(*data);
+			return *data;
+		}
+
+		float* _prepareAccumulate(const size_t* targetShape, size_t targetDims, float beta);
+		float* _prepareAccumulate(const std::vector<size_t>& targetShape, float beta) { return _prepareAccumulate(targetShape.data(), targetShape.size(), beta); }
+		float* _prepareAccumulate(std::initializer_list<size_t> targetShape, float beta) { return _prepareAccumulate(targetShape.begin(), targetShape.size(), beta); }
+
+		void _setData(std::vector<float>&& newData);
 
 		template<typename ICurrent, typename... IRest>
 		size_t _getIndex(size_t acc, size_t mult, ICurrent index, IRest... rest) const
@@ -10,6 +10,7 @@
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include "Trace.h"
 
 // https://github.com/progschj/ThreadPool
 class ThreadPool
@@ -47,6 +48,7 @@ public:
 					}
 
 					// Run task
+					tbml::trace::Scope scope("ThreadPool task");
 					task();
 				}
 			});
@@ -0,0 +1,142 @@
+#include "stdafx.h"
+#include <atomic>
+#include <memory>
+#include "Trace.h"
+
+namespace tbml
+{
+	namespace trace
+	{
+		namespace
+		{
+			using Clock = std::chrono::steady_clock;
+
+			struct Event
+			{
+				const char* name;
+				const char* argName;
+				int64_t argValue;
+				Clock::time_point time;
+				char phase;
+			};
+
+			// Written only by its thread, head counts every event ever recorded
+			// start is where clear() last cut and is only touched under the registry lock
+			struct ThreadBuffer
+			{
+				size_t threadId;
+				std::vector<Event> events;
+				std::atomic<size_t> head;
+				size_t start;
+
+				ThreadBuffer(size_t threadId) : threadId(threadId), events(EVENT_CAPACITY), head(0), start(0) {}
+			};
+
+			std::atomic<bool> isTracing(false);
+			std::mutex registryMutex;
+			std::vector<std::unique_ptr<ThreadBuffer>> registry;
+			const Clock::time_point traceEpoch = Clock::now();
+
+			ThreadBuffer& getThreadBuffer()
+			{
+				// Registered on first use, buffers outlive their threads so can be dumped after they exit
+				thread_local ThreadBuffer* buffer = nullptr;
+				if (buffer == nullptr)
+				{
+					std::lock_guard<std::mutex> lock(registryMutex);
+					registry.push_back(std::make_unique<ThreadBuffer>(registry.size()));
+					buffer = registry.back().get();
+				}
+				return *buffer;
+			}
+
+			void record(char phase, const char* name, const char* argName, int64_t argValue)
+			{
+				// Publish the slot with a release so readers see it complete
+				ThreadBuffer& buffer = getThreadBuffer();
+				size_t head = buffer.head.load(std::memory_order_relaxed);
+				buffer.events[head % EVENT_CAPACITY] = { name, argName, argValue, Clock::now(), phase };
+				buffer.head.store(head + 1, std::memory_order_release);
+			}
+		}
+
+		void setEnabled(bool enabled)
+		{
+			isTracing.store(enabled, std::memory_order_relaxed);
+		}
+
+		bool isEnabled()
+		{
+			return isTracing.load(std::memory_order_relaxed);
+		}
+
+		void begin(const char* name, const char* argName, int64_t argValue)
+		{
+			record('B', name, argName, argValue);
+		}
+
+		void end(const char* name)
+		{
+			record('E', name, nullptr, 0);
+		}
+
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			for (auto& buffer : registry) buffer->start = buffer->head.load(std::memory_order_acquire);
+		}
+
+		void writeChromeTrace(std::ostream& os)
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			std::ios::fmtflags flags = os.flags();
+			std::streamsize precision = os.precision();
+			os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			bool isFirst = true;
+			std::vector<Event> events;
+			for (auto& buffer : registry)
+			{
+				// Copy what is still in the ring then drop anything the thread overwrote during the copy
+				size_t head = buffer->head.load(std::memory_order_acquire);
+				size_t first = std::max(buffer->start, head > EVENT_CAPACITY ? head - EVENT_CAPACITY : (size_t)0);
+				events.clear();
+				for (size_t i = first; i < head; i++) events.push_back(buffer->events[i % EVENT_CAPACITY]);
+				size_t overwritten = buffer->head.load(std::memory_order_acquire);
+				size_t valid = overwritten > EVENT_CAPACITY ? overwritten - EVENT_CAPACITY : 0;
+				size_t skip = valid > first ? std::min(valid - first, events.size()) : 0;
+
+				// Ends whose begin was lost would close the wrong slice so are skipped
+				os << (isFirst ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId
+					<< ",\"args\":{\"name\":\"Thread " << buffer->threadId << "\"}}";
+				isFirst = false;
+				size_t depth = 0;
+				for (size_t i = skip; i < events.size(); i++)
+				{
+					const Event& event = events[i];
+					if (event.phase == 'E')
+					{
+						if (depth == 0) continue;
+						depth--;
+					}
+					else depth++;
+
+					double us = std::chrono::duration<double, std::micro>(event.time - traceEpoch).count();
+					os << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":" << buffer->threadId
+						<< ",\"ts\":" << std::fixed << std::setprecision(3) << us;
+					if (event.argName != nullptr) os << ",\"args\":{\"" << event.argName << "\":" << event.argValue << "}";
+					os << "}";
+				}
+			}
+			os << "\n]}\n";
+			os.flags(flags);
+			os.precision(precision);
+		}
+
+		void saveChromeTrace(const std::string& filename)
+		{
+			std::ofstream file(filename);
+			if (!file.is_open()) throw std::runtime_error("Failed to open file for writing");
+			writeChromeTrace(file);
+		}
+	}
+}
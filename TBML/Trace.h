@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace tbml
+{
+	// Timeline of begin / end events per thread, written as Chrome trace JSON for chrome://tracing or Perfetto
+	// Each thread records into its own ring buffer without locking, the oldest events are overwritten when full
+	namespace trace
+	{
+		// Events kept per thread
+		const size_t EVENT_CAPACITY = 1 << 16;
+
+		// Off by default, when off each Scope costs one relaxed atomic load
+		void setEnabled(bool enabled);
+		bool isEnabled();
+
+		// Name and argName must outlive the trace, e.g. string literals
+		void begin(const char* name, const char* argName = nullptr, int64_t argValue = 0);
+		void end(const char* name);
+
+		// Drop events recorded so far on every thread
+		void clear();
+
+		// Events of every thread so far, can be called while tracing but events overwritten meanwhile are dropped
+		void writeChromeTrace(std::ostream& os);
+		void saveChromeTrace(const std::string& filename);
+
+		// Begin on construction and end on destruction if tracing was enabled at construction
+		class Scope
+		{
+		public:
+			Scope(const char* name, const char* argName = nullptr, int64_t argValue = 0)
+				: name(isEnabled() ? name : nullptr)
+			{
+				if (this->name != nullptr) begin(name, argName, argValue);
+			}
+
+			~Scope() { if (name != nullptr) end(name); }
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+		private:
+			const char* const name;
+		};
+	}
+}
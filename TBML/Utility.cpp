@@ -36,17 +36,16 @@ float tbml::fn::classificationAccuracy(const tbml::Tensor& output, const tbml::T
 	assert(output.getShape() == expected.getShape());
 	assert(output.getDims() == 2);
 	size_t rows = output.getShape(0);
-	size_t cols = output.getShape(1);
-
-	float accuracy = 0.0f;
-	for (size_t row = 0; row < rows; row++)
-	{
-		size_t predictedClass = argmax(output, row);
-		size_t expectedClass = argmax(expected, row);
-		accuracy += ((predictedClass == expectedClass) ? 1.0f : 0.0f) / rows;
-	}
-
-	return accuracy;
+	if (rows == 0) return 0.0f;
+
+	// Batched argmax of both then a count, see classificationMetrics for top-k and confusion
+	std::vector<uint32_t> predictedClasses;
+	std::vector<uint32_t> expectedClasses;
+	output.argmaxRows(predictedClasses);
+	expected.argmaxRows(expectedClasses);
+	size_t correct = 0;
+	for (size_t row = 0; row < rows; row++) correct += predictedClasses[row] == expectedClasses[row] ? 1 : 0;
+	return (float)correct / rows;
 }
 
 std::shared_ptr<tbml::fn::LossFunction> tbml::fn::LossFunction::deserialize(std::istream& is)
@@ -23,6 +23,20 @@ namespace tbml
 		public:
 			virtual float calculate(const Tensor& output, const Tensor& expected) const = 0;
 			virtual Tensor derivative(const Tensor& output, const Tensor& expected) const = 0;
+
+			// Writes derivative into gradient's storage and returns calculate, fused into one pass where overridden
+			virtual float calculateWithGradient(const Tensor& output, const Tensor& expected, Tensor& gradient) const
+			{
+				gradient = derivative(output, expected);
+				return calculate(output, expected);
+			}
+
+			// Whether calculate is a mean over rows rather than a sum, e.g. CrossEntropy
+			virtual bool isMeanOverRows() const { return false; }
+
+			// Weight of the loss over subsetRows of totalRows, so weighted subset losses add up to calculate over every row
+			float getSubsetWeight(size_t subsetRows, size_t totalRows) const { return isMeanOverRows() ? (float)subsetRows / totalRows : 1.0f; }
+
 			virtual void serialize(std::ostream& os) const = 0;
 			static std::shared_ptr<LossFunction> deserialize(std::istream& is);
 		};
@@ -55,6 +69,11 @@ namespace tbml
 				return output - expected;
 			};
 
+			float calculateWithGradient(const Tensor& output, const Tensor& expected, Tensor& gradient) const override
+			{
+				return gradient.squareErrorGrad(output, expected);
+			}
+
 			void serialize(std::ostream& os) const override
 			{
 				os << "SquareError\n";
@@ -76,7 +95,7 @@ namespace tbml
 				{
 					error += -expectedData[i] * std::log(predictedData[i] + float(1e-15f));
 				}
-				return error / output.getShape()[0];
+				return error / output.getShape(0);
 			};
 
 			Tensor derivative(const Tensor& output, const Tensor& expected) const override
@@ -87,6 +106,13 @@ namespace tbml
 				return expected.ewised(output, [](float expected, float output) { return -expected / (output + 1e-15f); });
 			};
 
+			float calculateWithGradient(const Tensor& output, const Tensor& expected, Tensor& gradient) const override
+			{
+				return gradient.crossEntropyGrad(output, expected) / output.getShape(0);
+			}
+
+			bool isMeanOverRows() const override { return true; }
+
 			void serialize(std::ostream& os) const override
 			{
 				os << "CrossEntropy\n";
@@ -48,7 +48,10 @@ const size_t VectorListGenome::getSize() const { return this->dataSize; }
 
 NNGenome::NNGenome(tbml::nn::NeuralNetwork&& network)
 	: network(std::move(network))
-{}
+{
+	// Genomes are immutable so compile once, agents share the model across threads
+	model = this->network.compileForInference();
+}
 
 NNGenome::GenomeCPtr NNGenome::crossover(const NNGenome::GenomeCPtr& otherData, float mutateChance) const
 {
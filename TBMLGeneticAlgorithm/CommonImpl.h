@@ -29,9 +29,11 @@ public:
 
 	NNGenome::GenomeCPtr crossover(const NNGenome::GenomeCPtr& otherData, float mutateChance) const override;
 	const tbml::nn::NeuralNetwork& getNetwork() const { return this->network; }
+	const tbml::nn::InferenceModel& getModel() const { return this->model; }
 	size_t getInputSize() const { return this->network.getInputShape()[0]; }
 	void print() const;
 
 private:
 	tbml::nn::NeuralNetwork network;
+	tbml::nn::InferenceModel model;
 };
@@ -41,7 +41,7 @@ bool NNPoleBalancerAgent::evaluate()
 		cartAcceleration,
 		poleAngle,
 		poleAcceleration });
-	genome->getNetwork().propogateMut(netInput);
+	genome->getModel().propogateMut(netInput);
 	float ft = netInput(0, 0) * force;
 
 	// Calculate acceleration
@@ -39,7 +39,7 @@ bool NNTargetAgent::evaluate()
 		targetPos1.y - pos.y,
 		vel.x,
 		vel.y });
-	genome->getNetwork().propogateMut(netInput);
+	genome->getModel().propogateMut(netInput);
 
 	// Update position, velocity, drag
 	vel.x += netInput(0, 0) * moveAcc * (1.0f / 60.0f);
@@ -0,0 +1,288 @@
+﻿#include <vector>
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+using Socket = SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+using Socket = int;
+const Socket INVALID_SOCKET = -1;
+#endif
+
+#include "NeuralNetwork.h"
+#include "InferenceServer.h"
+
+// Protocol over the socket: a client sends rows of inputSize float32s and gets back a row of outputSize float32s for each
+
+struct Options
+{
+	std::string modelPath = "../TBMLNeuralNetwork/MNIST.nn";
+	std::string socketPath;
+	tbml::nn::ServerConfig config;
+	size_t benchClients = 0;
+	size_t benchRequests = 0;
+};
+
+Options parseOptions(int argc, char** argv);
+void serve(tbml::nn::InferenceServer& server, const std::string& socketPath);
+void bench(tbml::nn::InferenceServer& server, const Options& options);
+
+Socket openListener(const std::string& path);
+Socket openConnection(const std::string& path);
+void closeSocket(Socket socket);
+bool sendAll(Socket socket, const void* data, size_t size);
+bool receiveAll(Socket socket, void* data, size_t size);
+
+int main(int argc, char** argv)
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+	Options options = parseOptions(argc, argv);
+
+	// Compile the network once, the frozen model is shared by every worker
+	tbml::nn::NeuralNetwork network = tbml::nn::loadFromFile(options.modelPath);
+	tbml::nn::InferenceServer server(network.compileForInference(), options.config);
+	printf("Loaded %s: %zd -> %zd, max batch %zd, max latency %lldus, %zd workers\n",
+		options.modelPath.c_str(), server.getModel().getInputSize(), server.getModel().getOutputSize(),
+		options.config.maxBatchSize, (long long)options.config.maxLatency.count(), options.config.workerCount);
+
+	if (options.benchClients > 0) bench(server, options);
+	else serve(server, options.socketPath.empty() ? "tbml.sock" : options.socketPath);
+	return 0;
+}
+
+Options parseOptions(int argc, char** argv)
+{
+	Options options;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--socket" && hasValue) options.socketPath = argv[++i];
+		else if (arg == "--max-batch" && hasValue) options.config.maxBatchSize = std::stoul(argv[++i]);
+		else if (arg == "--max-latency-us" && hasValue) options.config.maxLatency = std::chrono::microseconds(std::stoll(argv[++i]));
+		else if (arg == "--workers" && hasValue) options.config.workerCount = std::stoul(argv[++i]);
+		else if (arg == "--bench" && i + 2 < argc)
+		{
+			options.benchClients = std::stoul(argv[++i]);
+			options.benchRequests = std::stoul(argv[++i]);
+		}
+		else if (arg[0] != '-') options.modelPath = arg;
+		else
+		{
+			printf("Usage: %s [model.nn] [--socket path] [--max-batch n] [--max-latency-us n] [--workers n] [--bench clients requests]\n", argv[0]);
+			printf("  --bench runs clients against the server in process, or over --socket when given, then prints latency\n");
+			exit(1);
+		}
+	}
+	return options;
+}
+
+void handleClient(tbml::nn::InferenceServer& server, Socket client)
+{
+	size_t inputSize = server.getModel().getInputSize();
+	size_t outputSize = server.getModel().getOutputSize();
+
+	// One request in flight per connection, clients wanting more open more connections
+	while (true)
+	{
+		std::vector<float> input(inputSize);
+		if (!receiveAll(client, input.data(), inputSize * sizeof(float))) break;
+		std::vector<float> output = server.predict(std::move(input));
+		if (!sendAll(client, output.data(), outputSize * sizeof(float))) break;
+	}
+	closeSocket(client);
+}
+
+void acceptClients(tbml::nn::InferenceServer& server, Socket listener)
+{
+	while (true)
+	{
+		Socket client = accept(listener, nullptr, nullptr);
+		if (client == INVALID_SOCKET) break;
+		std::thread(handleClient, std::ref(server), client).detach();
+	}
+}
+
+void serve(tbml::nn::InferenceServer& server, const std::string& socketPath)
+{
+	Socket listener = openListener(socketPath);
+	printf("Listening on %s\n", socketPath.c_str());
+	fflush(stdout);
+	std::thread(acceptClients, std::ref(server), listener).detach();
+
+	// Report each window that saw requests until killed
+	while (true)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(5));
+		tbml::nn::InferenceServer::Stats stats = server.getStats();
+		if (stats.requests == 0) continue;
+		stats.print();
+		fflush(stdout);
+		server.resetStats();
+	}
+}
+
+void bench(tbml::nn::InferenceServer& server, const Options& options)
+{
+	const tbml::nn::InferenceModel& model = server.getModel();
+	size_t inputSize = model.getInputSize();
+	size_t outputSize = model.getOutputSize();
+	size_t total = options.benchClients * options.benchRequests;
+
+	// Pixel-like inputs in [0, 1]
+	std::vector<std::vector<float>> inputs(options.benchRequests, std::vector<float>(inputSize));
+	for (auto& input : inputs) for (float& value : input) value = (float)rand() / RAND_MAX;
+
+	// Baseline is what every client does today, one forward per request
+	{
+		std::vector<float> output(outputSize);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < total; i++) model.propogate(inputs[i % inputs.size()].data(), 1, output.data());
+		auto end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+		printf("Unbatched: %zd requests, %.3fms each, %.0f requests/s\n", total, seconds * 1000.0 / total, total / seconds);
+	}
+
+	bool useSocket = !options.socketPath.empty();
+	Socket listener = INVALID_SOCKET;
+	if (useSocket)
+	{
+		listener = openListener(options.socketPath);
+		std::thread(acceptClients, std::ref(server), listener).detach();
+	}
+
+	// Closed loop clients, each waits for its reply before sending the next request
+	// An exception escaping a std::thread terminates the process, so clients record failures and stop instead
+	server.resetStats();
+	std::vector<std::thread> clients;
+	std::atomic<size_t> failedClients(0);
+	for (size_t c = 0; c < options.benchClients; c++)
+	{
+		clients.emplace_back([&]()
+		{
+			Socket connection = INVALID_SOCKET;
+			try
+			{
+				if (useSocket) connection = openConnection(options.socketPath);
+				std::vector<float> output(outputSize);
+				for (size_t i = 0; i < options.benchRequests; i++)
+				{
+					const std::vector<float>& input = inputs[i];
+					if (!useSocket) output = server.predict(std::vector<float>(input));
+					else if (!sendAll(connection, input.data(), inputSize * sizeof(float)) || !receiveAll(connection, output.data(), outputSize * sizeof(float)))
+					{
+						throw std::runtime_error("Lost connection to server");
+					}
+				}
+			}
+			catch (const std::exception& e)
+			{
+				if (failedClients++ == 0) printf("Client failed: %s\n", e.what());
+			}
+			if (connection != INVALID_SOCKET) closeSocket(connection);
+		});
+	}
+	for (std::thread& client : clients) client.join();
+
+	printf("Batched (%zd clients%s): ", options.benchClients, useSocket ? " over socket" : "");
+	server.getStats().print();
+	if (failedClients > 0) printf("%zd of %zd clients failed, stats only cover the requests served\n", failedClients.load(), options.benchClients);
+	if (useSocket)
+	{
+		closeSocket(listener);
+		std::remove(options.socketPath.c_str());
+	}
+}
+
+Socket openListener(const std::string& path)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path too long");
+	memcpy(address.sun_path, path.c_str(), path.size());
+
+	// A stale socket file from a previous run would fail bind
+	std::remove(path.c_str());
+	Socket listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET) throw std::runtime_error("Could not create socket");
+	if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+	{
+		closeSocket(listener);
+		throw std::runtime_error("Could not listen on " + path);
+	}
+	return listener;
+}
+
+Socket openConnection(const std::string& path)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path too long");
+	memcpy(address.sun_path, path.c_str(), path.size());
+
+	Socket connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connection == INVALID_SOCKET) throw std::runtime_error("Could not create socket");
+	if (connect(connection, (sockaddr*)&address, sizeof(address)) != 0)
+	{
+		closeSocket(connection);
+		throw std::runtime_error("Could not connect to " + path);
+	}
+	return connection;
+}
+
+void closeSocket(Socket socket)
+{
+#ifdef _WIN32
+	closesocket(socket);
+#else
+	shutdown(socket, SHUT_RDWR);
+	close(socket);
+#endif
+}
+
+bool sendAll(Socket socket, const void* data, size_t size)
+{
+	// Disconnected clients should end their connection, not the process
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_NOSIGNAL;
+#else
+	const int flags = 0;
+#endif
+	const char* bytes = (const char*)data;
+	while (size > 0)
+	{
+		int sent = (int)send(socket, bytes, (int)size, flags);
+		if (sent <= 0) return false;
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+bool receiveAll(Socket socket, void* data, size_t size)
+{
+	char* bytes = (char*)data;
+	while (size > 0)
+	{
+		int received = (int)recv(socket, bytes, (int)size, 0);
+		if (received <= 0) return false;
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
@@ -29,6 +29,7 @@ void Game::initVariables()
 	network = tbml::nn::loadFromFile("../TBMLNeuralNetwork/MNIST.nn");
 	network.print();
 	std::cout << "Parameters: " << network.getParameterCount() << std::endl;
+	model = network.compileForInference();
 
 	// Init the grid and text
 	grid = DrawableGrid(this->window, 28, 28, 400.0f / 28.0f);
@@ -115,7 +116,7 @@ void Game::updateGuess()
 	tbml::Tensor input(shape, data);
 
 	// Predict the digit
-	tbml::Tensor output = network.propogate(input); // 1x10 tensor
+	tbml::Tensor output = model.propogate(input); // 1x10 tensor
 
 	// Get the digit
 	int digit = 0;
@@ -16,6 +16,7 @@ private:
 	void updateGuess();
 
 	tbml::nn::NeuralNetwork network;
+	tbml::nn::InferenceModel model;
 	DrawableGrid grid;
 	sf::Font font;
 	sf::Text guessText;
@@ -6,6 +6,9 @@
 #include "MNIST.h"
 #include "ThreadPool.h"
 #include "NeuralNetwork.h"
+#include "ModelGraph.h"
+#include "Sweep.h"
+#include "Metrics.h"
 #include "Utility.h"
 #include "Tensor.h"
 
@@ -15,6 +18,14 @@ void testTraining();
 void testSerialization();
 void testMNIST();
 void testMNISTSerialization();
+void testDenseGradients();
+void testAsyncTraining();
+void testOptimizers();
+void testPruning();
+void testModelGraph();
+void testSweep();
+void testMetrics();
+void testConv2D();
 
 int main()
 {
@@ -140,17 +151,145 @@ void testMNIST()
 		std::make_unique<tbml::nn::Layer::Dense>(100, 10),
 		std::make_unique<tbml::nn::Layer::Softmax>() });
 	std::cout << "\nParameters: " << network.getParameterCount() << std::endl << std::endl;
-	network.train(trainInput, trainExpected, std::make_shared<tbml::fn::CrossEntropy>(), { 10, 100, 0.02f, 0.9f, 0.01f, 3, 100 });
+	network.train(trainInput, trainExpected, std::make_shared<tbml::fn::CrossEntropy>(), { 10, 100, 0.02f, 0.9f, 0.01f, 3, 100, -1 });
 
-	// Test network against test data
-	tbml::Tensor testPredicted = network.propogate(testInput);
-	float accuracy = tbml::fn::classificationAccuracy(testPredicted, testExpected);
-	std::cout << "t10k Accuracy = " << (accuracy * 100) << "%" << std::endl;
+	// Test network against test data in chunks
+	tbml::nn::Evaluation evaluation = network.evaluate(testInput, testExpected, std::make_shared<tbml::fn::CrossEntropy>(), 1000);
+	std::cout << "t10k Loss = " << evaluation.loss << ", Accuracy = " << (evaluation.accuracy * 100) << "%" << std::endl;
 
 	// Save network to file
 	// network.saveToFile("MNIST.nn");
 }
 
+void testAsyncTraining()
+{
+	// Read training / test datasets
+	size_t trainImageCount, trainImageSize, trainLabelCount;
+	size_t testImageCount, testImageSize, testLabelCount;
+	tbml::Tensor trainInput = MNIST::readImagesTensor("MNIST/train-images.idx3-ubyte", trainImageCount, trainImageSize);
+	tbml::Tensor trainExpected = MNIST::readLabelsTensor("MNIST/train-labels.idx1-ubyte", trainLabelCount);
+	tbml::Tensor testInput = MNIST::readImagesTensor("MNIST/t10k-images.idx3-ubyte", testImageCount, testImageSize);
+	tbml::Tensor testExpected = MNIST::readLabelsTensor("MNIST/t10k-labels.idx1-ubyte", testLabelCount);
+
+	// Train the same initial network synchronously then asynchronously on every core
+	tbml::nn::NeuralNetwork initial({
+		std::make_shared<tbml::nn::Layer::Dense>(784, 100),
+		std::make_shared<tbml::nn::Layer::ReLU>(),
+		std::make_shared<tbml::nn::Layer::Dense>(100, 10),
+		std::make_shared<tbml::nn::Layer::Softmax>() });
+	for (bool asynchronous : { false, true })
+	{
+		tbml::nn::NeuralNetwork network = initial.clone();
+		tbml::nn::TrainingConfig config = { 10, 100, 0.02f, 0.9f, 0.01f, 1, 100, -1 };
+		config.asynchronous = asynchronous;
+		network.train(trainInput, trainExpected, std::make_shared<tbml::fn::CrossEntropy>(), config);
+
+		tbml::Tensor testPredicted = network.propogate(testInput);
+		float accuracy = tbml::fn::classificationAccuracy(testPredicted, testExpected);
+		std::cout << (asynchronous ? "Asynchronous" : "Synchronous") << " t10k Accuracy = " << (accuracy * 100) << "%" << std::endl << std::endl;
+	}
+}
+
+void testOptimizers()
+{
+	// Read training / test datasets
+	size_t trainImageCount, trainImageSize, trainLabelCount;
+	size_t testImageCount, testImageSize, testLabelCount;
+	tbml::Tensor trainInput = MNIST::readImagesTensor("MNIST/train-images.idx3-ubyte", trainImageCount, trainImageSize);
+	tbml::Tensor trainExpected = MNIST::readLabelsTensor("MNIST/train-labels.idx1-ubyte", trainLabelCount);
+	tbml::Tensor testInput = MNIST::readImagesTensor("MNIST/t10k-images.idx3-ubyte", testImageCount, testImageSize);
+	tbml::Tensor testExpected = MNIST::readLabelsTensor("MNIST/t10k-labels.idx1-ubyte", testLabelCount);
+
+	// Train the same initial network with each optimizer, uniform [-1, 1] weights need Adam rates near 0.01
+	tbml::nn::NeuralNetwork initial({
+		std::make_shared<tbml::nn::Layer::Dense>(784, 100),
+		std::make_shared<tbml::nn::Layer::ReLU>(),
+		std::make_shared<tbml::nn::Layer::Dense>(100, 10),
+		std::make_shared<tbml::nn::Layer::Softmax>() });
+	std::vector<tbml::nn::OptimizerPtr> optimizers = {
+		std::make_shared<tbml::nn::SGD>(0.02f, 0.9f),
+		std::make_shared<tbml::nn::Adam>(0.01f),
+		std::make_shared<tbml::nn::AdamW>(0.01f, 0.01f) };
+	for (const auto& optimizer : optimizers)
+	{
+		tbml::nn::NeuralNetwork network = initial.clone();
+		tbml::nn::TrainingConfig config = { 3, 100, 0.0f, 0.0f, 0.01f, 1, 100, -1 };
+		config.optimizer = optimizer;
+		auto start = std::chrono::steady_clock::now();
+		network.train(trainInput, trainExpected, std::make_shared<tbml::fn::CrossEntropy>(), config);
+		auto end = std::chrono::steady_clock::now();
+
+		tbml::Tensor testPredicted = network.propogate(testInput);
+		float accuracy = tbml::fn::classificationAccuracy(testPredicted, testExpected);
+		float seconds = std::chrono::duration<float>(end - start).count();
+		std::cout << optimizer->getName() << " t10k Accuracy = " << (accuracy * 100) << "% in " << seconds << "s" << std::endl << std::endl;
+	}
+}
+
+void testDenseGradients()
+{
+	// MNIST sized Dense layer with random input and output gradient
+	const size_t batchSize = 100, inputSize = 784, outputSize = 100;
+	tbml::nn::Layer::Dense dense(inputSize, outputSize);
+	tbml::Tensor input({ batchSize, inputSize }, 0);
+	tbml::Tensor gradOutput({ batchSize, outputSize }, 0);
+	input.map([](float _) { return tbml::fn::getRandomFloat() * 2 - 1; });
+	gradOutput.map([](float _) { return tbml::fn::getRandomFloat() * 2 - 1; });
+
+	// Time the previous scalar loop (serial, as the parallel version races)
+	size_t iterations = 20;
+	tbml::Tensor loopWeights, loopBias;
+	std::chrono::steady_clock::time_point t00 = std::chrono::steady_clock::now();
+	for (size_t it = 0; it < iterations; it++)
+	{
+		loopWeights = tbml::Tensor({ inputSize, outputSize }, 0);
+		loopBias = tbml::Tensor({ 1, outputSize }, 0);
+		for (size_t batchRow = 0; batchRow < batchSize; batchRow++)
+		{
+			for (size_t i = 0; i < inputSize; i++)
+			{
+				for (size_t j = 0; j < outputSize; j++) loopWeights(i, j) += (input(batchRow, i) * gradOutput(batchRow, j)) / batchSize;
+			}
+			for (size_t j = 0; j < outputSize; j++) loopBias(0, j) += gradOutput(batchRow, j) / batchSize;
+		}
+	}
+	std::chrono::steady_clock::time_point t01 = std::chrono::steady_clock::now();
+
+	// Time the GEMM based backpropogate
+	dense.propogatePtr(&input);
+	std::chrono::steady_clock::time_point t10 = std::chrono::steady_clock::now();
+	for (size_t it = 0; it < iterations; it++) dense.backpropogate(&gradOutput);
+	std::chrono::steady_clock::time_point t11 = std::chrono::steady_clock::now();
+
+	// Serial reference of the same formulation, summed over the batch in order
+	float batchScale = 1.0f / (float)batchSize;
+	tbml::Tensor refWeights({ inputSize, outputSize }, 0);
+	tbml::Tensor refBias({ 1, outputSize }, 0);
+	for (size_t j = 0; j < outputSize; j++)
+	{
+		for (size_t i = 0; i < inputSize; i++)
+		{
+			float acc = 0.0f;
+			for (size_t batchRow = 0; batchRow < batchSize; batchRow++) acc += input(batchRow, i) * gradOutput(batchRow, j);
+			refWeights(i, j) = batchScale * acc;
+		}
+		float acc = 0.0f;
+		for (size_t batchRow = 0; batchRow < batchSize; batchRow++) acc += gradOutput(batchRow, j);
+		refBias(0, j) = batchScale * acc;
+	}
+
+	// Compare exactly against the reference and loosely against the old loop
+	bool exact = refWeights.getData() == dense.getGradWeights().getData() && refBias.getData() == dense.getGradBias().getData();
+	float maxLoopDiff = 0.0f;
+	for (size_t i = 0; i < refWeights.getSize(); i++) maxLoopDiff = std::max(maxLoopDiff, std::abs(loopWeights.getData()[i] - dense.getGradWeights().getData()[i]));
+
+	float tLoop = std::chrono::duration_cast<std::chrono::microseconds>(t01 - t00).count() / (1000.0f * iterations);
+	float tGemm = std::chrono::duration_cast<std::chrono::microseconds>(t11 - t10).count() / (1000.0f * iterations);
+	std::cout << "Backend: " << tbml::backend::get().getName() << std::endl;
+	std::cout << "Scalar loop: " << tLoop << "ms, GEMM backprop: " << tGemm << "ms, Speedup: " << (tLoop / tGemm) << "x" << std::endl;
+	std::cout << "Exact match with serial reference: " << (exact ? "yes" : "no") << ", Max diff to scalar loop: " << maxLoopDiff << std::endl;
+}
+
 void testMNISTSerialization()
 {
 	// Read training / test datasets
@@ -174,3 +313,174 @@ void testMNISTSerialization()
 	float accuracy = tbml::fn::classificationAccuracy(testPredicted, testExpected);
 	std::cout << "t10k Accuracy = " << (accuracy * 100) << "%" << std::endl;
 }
+
+void testPruning()
+{
+	// Read training / test datasets
+	size_t trainImageCount, trainImageSize, trainLabelCount;
+	size_t testImageCount, testImageSize, testLabelCount;
+	tbml::Tensor trainInput = MNIST::readImagesTensor("MNIST/train-images.idx3-ubyte", trainImageCount, trainImageSize);
+	tbml::Tensor trainExpected = MNIST::readLabelsTensor("MNIST/train-labels.idx1-ubyte", trainLabelCount);
+	tbml::Tensor testInput = MNIST::readImagesTensor("MNIST/t10k-images.idx3-ubyte", testImageCount, testImageSize);
+	tbml::Tensor testExpected = MNIST::readLabelsTensor("MNIST/t10k-labels.idx1-ubyte", testLabelCount);
+	tbml::fn::LossFunctionPtr lossFn = std::make_shared<tbml::fn::CrossEntropy>();
+
+	// Time the trained dense network as the baseline
+	tbml::nn::NeuralNetwork trained = tbml::nn::loadFromFile("MNIST.nn");
+	auto timeForward = [&](const tbml::nn::NeuralNetwork& network)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < 10; i++) network.propogate(testInput);
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / 10;
+	};
+	double denseTime = timeForward(trained);
+	tbml::nn::Evaluation denseEvaluation = trained.evaluate(testInput, testExpected, lossFn);
+	printf("Dense: t10k Accuracy = %.2f%%, Forward: %.2fms\n", denseEvaluation.accuracy * 100, denseTime);
+
+	// Prune each output to its largest weights, then fine-tune with the pruned weights held at zero
+	for (float sparsity : { 0.5f, 0.8f, 0.9f })
+	{
+		tbml::nn::NeuralNetwork network = trained.clone();
+		network.pruneToSparsity(sparsity);
+		tbml::nn::Evaluation pruned = network.evaluate(testInput, testExpected, lossFn);
+		double sparseTime = timeForward(network);
+
+		network.train(trainInput, trainExpected, lossFn, { 1, 100, 0.005f, 0.9f, 0.0f, 0, 100, -1 });
+		tbml::nn::Evaluation tuned = network.evaluate(testInput, testExpected, lossFn);
+		printf("%.0f%% sparse: t10k Accuracy = %.2f%% pruned, %.2f%% fine-tuned, Forward: %.2fms (%.2fx)\n",
+			network.getSparsity() * 100, pruned.accuracy * 100, tuned.accuracy * 100, sparseTime, denseTime / sparseTime);
+	}
+}
+
+void testModelGraph()
+{
+	// Read training / test datasets
+	size_t trainImageCount, trainImageSize, trainLabelCount;
+	size_t testImageCount, testImageSize, testLabelCount;
+	tbml::Tensor trainInput = MNIST::readImagesTensor("MNIST/train-images.idx3-ubyte", trainImageCount, trainImageSize);
+	tbml::Tensor trainExpected = MNIST::readLabelsTensor("MNIST/train-labels.idx1-ubyte", trainLabelCount);
+	tbml::Tensor testInput = MNIST::readImagesTensor("MNIST/t10k-images.idx3-ubyte", testImageCount, testImageSize);
+	tbml::Tensor testExpected = MNIST::readLabelsTensor("MNIST/t10k-labels.idx1-ubyte", testLabelCount);
+	tbml::fn::LossFunctionPtr lossFn = std::make_shared<tbml::fn::CrossEntropy>();
+
+	// Four towers over the image concatenated into the classifier, towers run concurrently
+	for (int threadCount : { 1, -1 })
+	{
+		tbml::nn::ModelGraph graph(threadCount);
+		std::vector<size_t> towers;
+		for (int i = 0; i < 4; i++)
+		{
+			size_t tower = graph.addLayer(std::make_shared<tbml::nn::Layer::Dense>(784, 32), tbml::nn::ModelGraph::INPUT);
+			towers.push_back(graph.addLayer(std::make_shared<tbml::nn::Layer::ReLU>(), tower));
+		}
+		size_t classifier = graph.addLayer(std::make_shared<tbml::nn::Layer::Dense>(128, 10), graph.addConcat(towers));
+		graph.addLayer(std::make_shared<tbml::nn::Layer::Softmax>(), classifier);
+
+		graph.train(trainInput, trainExpected, lossFn, { 3, 100, 0.1f, 0.1f, 0.0f, 1, 100 });
+
+		tbml::Tensor testPredicted = graph.propogate(testInput);
+		float accuracy = tbml::fn::classificationAccuracy(testPredicted, testExpected);
+		printf("%zd threads: t10k Accuracy = %.2f%%\n", graph.getThreadCount(), accuracy * 100);
+	}
+}
+
+void testSweep()
+{
+	// Read training / test datasets once, every job shares them
+	size_t trainImageCount, trainImageSize, trainLabelCount;
+	size_t testImageCount, testImageSize, testLabelCount;
+	tbml::Tensor trainInput = MNIST::readImagesTensor("MNIST/train-images.idx3-ubyte", trainImageCount, trainImageSize);
+	tbml::Tensor trainExpected = MNIST::readLabelsTensor("MNIST/train-labels.idx1-ubyte", trainLabelCount);
+	tbml::Tensor testInput = MNIST::readImagesTensor("MNIST/t10k-images.idx3-ubyte", testImageCount, testImageSize);
+	tbml::Tensor testExpected = MNIST::readLabelsTensor("MNIST/t10k-labels.idx1-ubyte", testLabelCount);
+	tbml::fn::LossFunctionPtr lossFn = std::make_shared<tbml::fn::CrossEntropy>();
+
+	// Sweep learning rate, momentum and batch size over the MNIST network shape
+	auto makeNetwork = []
+	{
+		return tbml::nn::NeuralNetwork({
+			std::make_shared<tbml::nn::Layer::Dense>(784, 100),
+			std::make_shared<tbml::nn::Layer::ReLU>(),
+			std::make_shared<tbml::nn::Layer::Dense>(100, 10),
+			std::make_shared<tbml::nn::Layer::Softmax>() });
+	};
+	tbml::nn::TrainingConfig base;
+	base.maxEpoch = 5;
+	std::vector<tbml::nn::TrainingConfig> configs = tbml::nn::Sweep::grid(base, { 0.01f, 0.05f, 0.2f, 1.0f }, { 0.0f, 0.9f }, { 32, 100, 500 });
+
+	tbml::nn::Sweep sweep(trainInput, trainExpected, testInput, testExpected);
+	sweep.run(makeNetwork, configs, lossFn, tbml::nn::SweepConfig());
+}
+
+void testMetrics()
+{
+	// Read test dataset
+	size_t testImageCount, testImageSize, testLabelCount;
+	tbml::Tensor testInput = MNIST::readImagesTensor("MNIST/t10k-images.idx3-ubyte", testImageCount, testImageSize);
+	tbml::Tensor testExpected = MNIST::readLabelsTensor("MNIST/t10k-labels.idx1-ubyte", testLabelCount);
+
+	// Accuracy, top-3 and the confusion matrix of the trained network in one pass
+	tbml::nn::NeuralNetwork network = tbml::nn::loadFromFile("MNIST.nn");
+	tbml::Tensor testPredicted = network.propogate(testInput);
+	auto start = std::chrono::high_resolution_clock::now();
+	tbml::fn::ClassificationMetrics metrics = tbml::fn::classificationMetrics(testPredicted, testExpected, 3);
+	auto end = std::chrono::high_resolution_clock::now();
+	metrics.print();
+	printf("Metrics: %.3fms\n", std::chrono::duration<double, std::milli>(end - start).count());
+}
+
+void testConv2D()
+{
+	// Read training / test datasets
+	size_t trainImageCount, trainImageSize, trainLabelCount;
+	size_t testImageCount, testImageSize, testLabelCount;
+	tbml::Tensor trainInput = MNIST::readImagesTensor("MNIST/train-images.idx3-ubyte", trainImageCount, trainImageSize);
+	tbml::Tensor trainExpected = MNIST::readLabelsTensor("MNIST/train-labels.idx1-ubyte", trainLabelCount);
+	tbml::Tensor testInput = MNIST::readImagesTensor("MNIST/t10k-images.idx3-ubyte", testImageCount, testImageSize);
+	tbml::Tensor testExpected = MNIST::readLabelsTensor("MNIST/t10k-labels.idx1-ubyte", testLabelCount);
+	tbml::fn::LossFunctionPtr lossFn = std::make_shared<tbml::fn::CrossEntropy>();
+
+	// 28x28 images straight from the rows, 5x5 same padded then a 3x3 stride 2 down to 14x14
+	tbml::backend::ConvShape conv1;
+	conv1.height = 28;
+	conv1.width = 28;
+	conv1.kernel = 5;
+	conv1.padding = 2;
+	tbml::backend::ConvShape conv2;
+	conv2.channels = 8;
+	conv2.height = 28;
+	conv2.width = 28;
+	conv2.kernel = 3;
+	conv2.stride = 2;
+	conv2.padding = 1;
+	tbml::nn::NeuralNetwork convNetwork({
+		std::make_shared<tbml::nn::Layer::Conv2D>(conv1, 8),
+		std::make_shared<tbml::nn::Layer::ReLU>(),
+		std::make_shared<tbml::nn::Layer::Conv2D>(conv2, 16),
+		std::make_shared<tbml::nn::Layer::ReLU>(),
+		std::make_shared<tbml::nn::Layer::Dense>(16 * 14 * 14, 10),
+		std::make_shared<tbml::nn::Layer::Softmax>() });
+	tbml::nn::NeuralNetwork denseNetwork({
+		std::make_shared<tbml::nn::Layer::Dense>(784, 100),
+		std::make_shared<tbml::nn::Layer::ReLU>(),
+		std::make_shared<tbml::nn::Layer::Dense>(100, 10),
+		std::make_shared<tbml::nn::Layer::Softmax>() });
+
+	// Train each for an epoch then time a forward pass of the test set
+	for (tbml::nn::NeuralNetwork* network : { &denseNetwork, &convNetwork })
+	{
+		printf("\nParameters: %zd\n", network->getParameterCount());
+		network->train(trainInput, trainExpected, lossFn, { 1, 100, 0.01f, 0.9f, 0.0f, 1, 100 });
+
+		auto start = std::chrono::high_resolution_clock::now();
+		tbml::nn::Evaluation evaluation = network->evaluate(testInput, testExpected, lossFn, 1000);
+		auto end = std::chrono::high_resolution_clock::now();
+		printf("t10k Accuracy = %.2f%%, Forward: %.2fms\n", evaluation.accuracy * 100, std::chrono::duration<double, std::milli>(end - start).count());
+	}
+
+	// Layers serialize their shape with their weights
+	convNetwork.saveToFile("MNISTConv.nn");
+	tbml::nn::NeuralNetwork loaded = tbml::nn::loadFromFile("MNISTConv.nn");
+	printf("Reloaded t10k Accuracy = %.2f%%\n", loaded.evaluate(testInput, testExpected, lossFn, 1000).accuracy * 100);
+}